@@ -0,0 +1,43 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Analog sampling. The channels in adc_channels in the cross file are
+ * converted one after another in the background, and each channel is reduced
+ * to the average, minimum and maximum over a window of adc_window samples.
+ */
+#ifndef _ADC_H
+#define _ADC_H
+
+#include <stdint.h>
+
+#define ADC_REF_VCC 0
+#define ADC_REF_AREF 1
+#define ADC_REF_1V1 2
+#define ADC_REF_2V56 3
+
+/* Raw 10-bit conversion results over the last complete window */
+struct adc_result {
+  uint16_t avg;
+  uint16_t min;
+  uint16_t max;
+};
+
+struct adc_report {
+  uint8_t report_id;
+  struct adc_result results[NUM_ADC_CHANNELS];
+};
+
+extern struct adc_report adc_report;
+
+/* Channels with a window in adc_report that has not been sent on the
+ * interrupt endpoint yet. Bit 0 is the first channel */
+extern uint8_t adc_updated;
+
+void init_adc(void);
+
+/* Collects the completed windows into adc_report */
+void adc_poll(void);
+
+#endif /* _ADC_H */
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Interface between the application, the USB bootloader and the host
+ * uploader (scripts/usb_upload.py).
+ *
+ * The bootloader sits at BOOTLOADER_ADDR, at the top of the flash. On the
+ * ATmega it is in the boot section, and the BOOTRST fuse makes the reset go
+ * to it. The ATtinies have no boot section, so the bootloader patches the
+ * application as it is written: the reset vector is changed to jump to the
+ * bootloader, and the USB interrupt vector to jump to a trampoline in the
+ * page below the bootloader, which passes the interrupt on to the
+ * bootloader or the application depending on which one is running.
+ */
+#ifndef _BOOTLOADER_H
+#define _BOOTLOADER_H
+
+#include <avr/io.h>
+#include <stdint.h>
+
+/*
+ * The application asks for the bootloader by writing BOOTLOADER_MAGIC to the
+ * last byte of the RAM and resetting with the watchdog. The byte holds the
+ * return address of main(), which never returns, and the bootloader reads
+ * it before anything is pushed on the stack
+ */
+#define BOOTLOADER_REQUEST (*(volatile uint8_t *)RAMEND)
+#define BOOTLOADER_MAGIC 0xB7
+
+/* Without a request, the bootloader is also entered with the reset pin, and
+ * starts the application after this long without a request from the host */
+#define BOOTLOADER_TIMEOUT_S 5
+
+#if BOOTLOADER_TRAMPOLINE
+#define BOOTLOADER_APP_END (BOOTLOADER_ADDR - SPM_PAGESIZE)
+#else
+#define BOOTLOADER_APP_END BOOTLOADER_ADDR
+#endif
+
+/* Vendor requests */
+#define BOOT_RQ_INFO 1
+/* Writes one page of flash at wIndex. Stalled if the page is not valid, or the
+ * last one has not been written yet */
+#define BOOT_RQ_WRITE 2
+/* Reads wLength bytes of flash at wIndex */
+#define BOOT_RQ_READ 3
+/* Starts the application */
+#define BOOT_RQ_EXIT 4
+
+#define BOOT_PROTOCOL_VERSION 1
+
+/* The first two words of the application (the reset and USB interrupt
+ * vectors) read back as written by the bootloader, not as uploaded */
+#define BOOT_FLAG_TRAMPOLINE 0x01
+
+struct boot_info {
+  uint8_t version;
+  uint8_t flags;
+  uint16_t page_size;
+  /* Bytes of flash available to the application */
+  uint16_t app_size;
+  /* Time the host must wait after writing a page. The ATtinies stop while
+   * the flash is written, so they don't answer USB packets during that time */
+  uint8_t write_ms;
+};
+
+#endif /* _BOOTLOADER_H */
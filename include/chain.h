@@ -0,0 +1,58 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Chain of expansion boards behind one USB board. The boards of the chain run
+ * the same firmware with the UART transport (see include/uart.h), with the
+ * addresses 1 to chain_boards, and the USB board sends them the commands
+ * for their relays. Commands are queued and sent one at a time from the main
+ * loop, so USB transfers never wait for the chain. While the queue is empty,
+ * the relay state of each board is read in turn, so that the state of the
+ * whole chain can be read from the USB board in one report.
+ *
+ * Each board has CHAIN_RELAYS_PER_BOARD relay numbers, whether or not it has
+ * that many relays. Relays 1 to 8 are on the USB board, 9 to 16 on board 1,
+ * and so on.
+ */
+#ifndef _CHAIN_H
+#define _CHAIN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CHAIN_RELAYS_PER_BOARD 8
+
+/* Longest command that can be forwarded, which is what is left of the USB
+ * feature report after CMD_FORWARD and the board */
+#define CHAIN_MAX_COMMAND 6
+
+struct chain_report {
+  uint8_t report_id;
+  /* Bit n is set if board n + 1 answered the last request it was sent */
+  uint32_t online;
+  /* Requests that were not answered after all of the retries */
+  uint16_t timeouts;
+  /* Commands that the boards rejected */
+  uint16_t rejected;
+  /* Commands that were not forwarded because the queue was full */
+  uint16_t dropped;
+  /* Relay state of the USB board, then of each board of the chain */
+  uint8_t state[1 + CHAIN_BOARDS];
+};
+
+extern struct chain_report chain_report;
+
+/*
+ * Queues a command for board, or for every board if it is UART_BROADCAST.
+ * Returns false if the board is not in the chain or the queue is full
+ */
+bool chain_forward(uint8_t board, uint8_t const *data, uint8_t len);
+
+/* Called by the UART transport with each answer it receives */
+void chain_answer(uint8_t address, uint8_t type, uint8_t const *data,
+                  uint8_t len);
+
+void chain_poll(uint8_t elapsed);
+
+#endif /* _CHAIN_H */
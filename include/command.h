@@ -0,0 +1,70 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Commands and reports, independent of how they reach the device. Each
+ * transport (USB feature reports in src/main.c, frames on the UART in
+ * src/uart.c) passes the commands it receives to command_handle() and reads
+ * reports with command_report(), so a board behaves the same on all of them.
+ */
+#ifndef _COMMAND_H
+#define _COMMAND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CMD_SET_SERIAL 0xFA
+#define CMD_ON 0xFF
+#define CMD_OFF 0xFD
+
+#define CMD_ALL_ON 0xFE
+#define CMD_ALL_OFF 0xFC
+
+#define CMD_SET_MASK 0xF9
+#define CMD_SET_PWM 0xF8
+#define CMD_RESET_COUNTERS 0xF7
+#define CMD_SET_RULE 0xF6
+#define CMD_SET_MACRO 0xF5
+#define CMD_RUN_MACRO 0xF4
+#define CMD_SET_POWER_ON 0xF3
+#define CMD_ENTER_BOOTLOADER 0xF2
+#define CMD_FORWARD 0xF1
+#define CMD_SET_BANK 0xF0
+
+/* Results of command_handle(). These are also what usbFunctionWrite() returns
+ * to V-USB, which stalls the transfer on COMMAND_REJECTED */
+#define COMMAND_OK 1
+#define COMMAND_REJECTED 0xFF
+
+/* Same as usbconfig.h, which sizes the USB serial number string with it */
+#define SERIAL_LEN (5)
+
+/* Length of the legacy relay report (REPORT_ID_RELAYS) */
+#define RELAYS_REPORT_LEN 8
+
+#if BOOTLOADER
+/* Set by CMD_ENTER_BOOTLOADER. The main loop starts the bootloader once the
+ * transport has answered the command */
+extern bool bootloader_requested;
+#endif
+
+/* Applies the power on state of the relays, and waits until they have all
+ * switched */
+void init_commands(void);
+
+void get_serial(uint8_t *data);
+void set_serial(uint8_t const *data);
+
+/* Runs the command in data. Returns COMMAND_REJECTED if the command is
+ * unknown or too short, or if it can't be forwarded to the chain */
+uint8_t command_handle(uint8_t const *data, uint8_t len);
+
+/*
+ * Points *data at the report with the given ID and returns its length, or
+ * returns 0 if the report is not present. The data stays valid until the next
+ * call
+ */
+uint8_t command_report(uint8_t id, uint8_t const **data);
+
+#endif /* _COMMAND_H */
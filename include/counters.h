@@ -0,0 +1,28 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Pulse counters on pin change interrupts. All counter inputs are on one I/O
+ * port (counter_ioport in the cross file) so that a single short interrupt
+ * handler can count them all.
+ */
+#ifndef _COUNTERS_H
+#define _COUNTERS_H
+
+#include <stdint.h>
+
+struct counters_report {
+  uint8_t report_id;
+  uint32_t counts[NUM_COUNTERS];
+};
+
+void init_counters(void);
+
+/* Takes a consistent copy of the counters for reporting */
+struct counters_report *counters_snapshot(void);
+
+/* Reset the counters in mask to 0. Bit 0 is counter 1 */
+void counters_reset(uint8_t mask);
+
+#endif /* _COUNTERS_H */
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Relay contact feedback. Relays with a feedback input (relay_N_feedback_ioport
+ * and relay_N_feedback_bit in the cross file) have the sensed state compared
+ * with the commanded state once the settle time after a switch has passed,
+ * and the time from the switch to the feedback edge is measured.
+ */
+#ifndef _FEEDBACK_H
+#define _FEEDBACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+struct feedback_stats {
+  uint8_t report_id;
+  /* Relays whose sensed state does not match the commanded state */
+  uint8_t mismatch;
+  /* Time from the last switch of each relay to its feedback edge, and the
+   * longest time seen, in units of 64 CPU cycles */
+  uint16_t latency[NUM_RELAYS];
+  uint16_t max_latency[NUM_RELAYS];
+};
+
+extern struct feedback_stats feedback_stats;
+
+void init_feedback(void);
+
+/* Called by the relay scheduler right after the driver switches a relay */
+void feedback_switched(uint8_t relay, bool on);
+
+/* Must be called on every pass of the main loop to time the edges closely */
+void feedback_poll(uint8_t elapsed);
+
+#endif /* _FEEDBACK_H */
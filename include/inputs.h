@@ -0,0 +1,21 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Debounced digital inputs. Each input is configured with input_N_ioport and
+ * input_N_bit in the cross file and is sampled on every system tick. A change
+ * is only accepted once the input has been stable for the debounce time.
+ */
+#ifndef _INPUTS_H
+#define _INPUTS_H
+
+#include <stdint.h>
+
+void init_inputs(void);
+void inputs_poll(uint8_t elapsed);
+
+/* Debounced state of the inputs. Bit 0 is input 1 */
+uint8_t get_input_state(void);
+
+#endif /* _INPUTS_H */
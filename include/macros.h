@@ -0,0 +1,52 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Relay macros. Each slot sets the relays in its care mask to the state in its
+ * mask, and can chain to another slot after a delay to play a sequence. The
+ * slots are stored in EEPROM and cached in RAM at boot.
+ */
+#ifndef _MACROS_H
+#define _MACROS_H
+
+#include <stdint.h>
+
+#include "timer.h"
+
+/* Slot index that ends a sequence, or stops the running one */
+#define MACRO_NONE 0xFF
+
+/* Delays are limited to a minute, or less if they would not fit 16 bits of
+ * ticks at F_CPU */
+#define MACRO_MAX_DELAY_MS                                                     \
+  (TIMER_MAX_DELAY_MS < 60000 ? TIMER_MAX_DELAY_MS : 60000)
+
+struct relay_macro {
+  uint8_t mask;
+  uint8_t care;
+  /* Slot run delay_ms after this one, or MACRO_NONE */
+  uint8_t next;
+  uint16_t delay_ms;
+};
+
+struct macros_report {
+  uint8_t report_id;
+  /* The slot the running sequence is waiting to run, or MACRO_NONE */
+  uint8_t running;
+  struct relay_macro macros[NUM_MACROS];
+};
+
+extern struct macros_report macros_report;
+
+void init_macros(void);
+
+/* Replaces slot index, both in RAM and in EEPROM */
+void macros_set(uint8_t index, struct relay_macro const *m);
+
+/* Runs slot index right away. Any other index stops the running sequence */
+void macros_run(uint8_t index);
+
+void macros_poll(uint8_t elapsed);
+
+#endif /* _MACROS_H */
@@ -13,4 +13,46 @@ void set_all_relays(bool on);
 void set_relay(uint8_t relay, bool on);
 uint8_t get_relay_state(void);
 
+/* Number of 8 relay banks. Relay n is bit n % 8 of bank n / 8 */
+#define RELAY_BANKS ((NUM_RELAYS + 7) / 8)
+
+#if RELAY_DRIVER_POLL
+/* Called on each pass of the main loop by drivers that write the relays in
+ * the background. Must return quickly, so that usbPoll() runs often enough */
+void poll_relays(void);
+/* Writes everything that poll_relays() would, before returning. Gives up
+ * after a few milliseconds if the relays do not answer. Only for start up */
+void flush_relays(void);
+#endif
+
+#if NUM_RELAYS > 8
+/* Set the relays of a bank in mask to the corresponding bit in state. Bank 0
+ * has the relays in get_relay_state() */
+void write_relay_bank(uint8_t bank, uint8_t mask, uint8_t state);
+uint8_t get_relay_bank_state(uint8_t bank);
+#endif
+
+/*
+ * Set the relays in mask to the corresponding bit in state. Used by the
+ * software PWM engine from interrupt context, so it must be short
+ */
+void write_relays(uint8_t mask, uint8_t state);
+
+/*
+ * Wraps the changes the drivers make to the relay ports from the main loop.
+ * With PWM, write_relays() can write the same ports from its interrupt, and a
+ * read-modify-write that it interrupts would undo its change
+ */
+#if USE_PWM
+#include <util/atomic.h>
+#define RELAY_PORT_UPDATE ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+#else
+#define RELAY_PORT_UPDATE
+#endif
+
+#if REPORT_SERIAL
+/* Sets the USB serial number string */
+void set_ram_serial(uint8_t const *data);
+#endif
+
 #endif /* _MAIN_H */
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * PWM for the relay outputs. Relays whose pin is routed to a Timer 1 output
+ * compare pin (relay_N_pwm_channel in the cross file) are modulated in
+ * hardware. All other relays use a software engine driven by a timer compare
+ * interrupt (see src/pwm.c).
+ */
+#ifndef _PWM_H
+#define _PWM_H
+
+#include <stdint.h>
+
+#define PWM_CHANNEL_NONE 0
+#define PWM_CHANNEL_OC1A 1
+#define PWM_CHANNEL_OC1B 2
+#define PWM_CHANNEL_OC1D 3
+
+/* Duty cycle that returns the output to plain on/off control by the driver */
+#define PWM_FULL 0xFF
+
+void pwm_init(void);
+
+/*
+ * Sets the duty cycle of a relay output. Any value other than PWM_FULL
+ * overrides the output latch of the relay until PWM_FULL is set again, after
+ * which the output must be set with the relay driver
+ */
+void pwm_set(uint8_t relay, uint8_t duty);
+
+#if PWM_SW_MASK
+/*
+ * Relays that the software engine is modulating. Their latch is toggled from
+ * its interrupt, so the drivers report them as on instead of reading it
+ */
+uint8_t pwm_sw_active(void);
+#else
+static inline uint8_t pwm_sw_active(void) { return 0; }
+#endif
+
+#endif /* _PWM_H */
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Relay scheduler. Sits between the commands and the relay driver when any
+ * switching policy is enabled. Commands only change the requested (target)
+ * state of the relays; the scheduler moves the driver towards the target as
+ * fast as the policies allow. When no policy is enabled, requests go straight
+ * to the driver.
+ */
+#ifndef _RELAYS_H
+#define _RELAYS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+#include "pwm.h"
+
+/* Mask of the relays in bank 0, which is all of them when there are at most
+ * 8. The relay scheduler and the features that use a mask are limited to
+ * these */
+#if NUM_RELAYS >= 8
+#define RELAY_ALL_MASK ((uint8_t)0xFF)
+#else
+#define RELAY_ALL_MASK ((uint8_t)((1 << NUM_RELAYS) - 1))
+#endif
+
+#if RELAY_SCHEDULER
+struct relay_stats {
+  uint8_t report_id;
+  /* Requests that arrived while a change was already pending on the relay
+   * and were merged into it */
+  uint16_t coalesced;
+  /* Requests for the state the relay was already in */
+  uint16_t skipped;
+  /* Requests that had to wait for the minimum dwell time to expire */
+  uint16_t deferred;
+};
+
+extern struct relay_stats relay_stats;
+
+/* Request the relays in mask to be set to the corresponding bit in state */
+void relays_request(uint8_t mask, uint8_t state);
+void relays_poll(uint8_t elapsed);
+
+/* The requested state of the relays, which the driver may not have reached
+ * yet */
+uint8_t relays_target(void);
+
+/* Waits until the relays have reached the requested state. Only for use
+ * before the system tick is started, e.g. for the power on state */
+void relays_settle(void);
+
+#if RELAY_PWM_MODE_MASK
+/* Set the duty cycle of a relay in PWM mode. 0 turns it off */
+void relays_set_duty(uint8_t relay, uint8_t duty);
+#endif
+
+#define request_all_relays(on) relays_request(RELAY_ALL_MASK, (on) ? 0xFF : 0)
+#define request_relay(relay, on) relays_request(1 << (relay), (on) ? 0xFF : 0)
+#else
+static inline void relays_request(uint8_t mask, uint8_t state) {
+#if NUM_RELAYS > 8
+  write_relay_bank(0, mask, state);
+#else
+  for (uint8_t i = 0; i < NUM_RELAYS; i++) {
+    if (mask & (1 << i)) {
+      set_relay(i, state & (1 << i));
+    }
+  }
+#endif
+}
+
+#if RELAY_PWM_MODE_MASK
+static inline void relays_set_duty(uint8_t relay, uint8_t duty) {
+  if (duty == 0 || duty == PWM_FULL) {
+    pwm_set(relay, PWM_FULL);
+    set_relay(relay, duty);
+  } else {
+    set_relay(relay, true);
+    pwm_set(relay, duty);
+  }
+}
+#endif
+
+static inline void relays_settle(void) {}
+
+static inline uint8_t relays_target(void) { return get_relay_state(); }
+
+#define request_all_relays(on) set_all_relays(on)
+#define request_relay(relay, on) set_relay(relay, on)
+#endif
+
+#endif /* _RELAYS_H */
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Feature report IDs. Report 0 is the legacy 8 byte relay report that is
+ * compatible with the commercial boards. The other reports are diagnostics
+ * that are only present when the corresponding feature is enabled. They are
+ * not declared in the HID report descriptor (doing so would change the
+ * format of the legacy report), so they must be requested by ID explicitly,
+ * e.g. with the hidraw HIDIOCGFEATURE ioctl. As required by HID, the first
+ * byte of each diagnostic report is its report ID.
+ */
+#ifndef _REPORTS_H
+#define _REPORTS_H
+
+#define REPORT_ID_RELAYS 0
+#define REPORT_ID_RELAY_STATS 1
+#define REPORT_ID_FEEDBACK 2
+#define REPORT_ID_COUNTERS 3
+#define REPORT_ID_ADC 4
+#define REPORT_ID_RULES 5
+#define REPORT_ID_MACROS 6
+#define REPORT_ID_WEAR 7
+#define REPORT_ID_TRACE 8
+#define REPORT_ID_USB_STATS 9
+#define REPORT_ID_STACK 10
+#define REPORT_ID_CHAIN 11
+#define REPORT_ID_RELAY_BANKS 12
+
+/*
+ * Input reports sent on the interrupt endpoint when usb_interrupt_reports is
+ * enabled. There is only one input report, so the first byte identifies the
+ * contents
+ */
+#define INTR_REPORT_INPUTS 1
+#define INTR_REPORT_ADC 2
+
+#endif /* _REPORTS_H */
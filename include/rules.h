@@ -0,0 +1,61 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Local rules linking the digital inputs to the relays, so that interlocks
+ * act without a round trip through the host. The rule table is stored in
+ * EEPROM, loaded at boot, and evaluated on every pass of the main loop.
+ */
+#ifndef _RULES_H
+#define _RULES_H
+
+#include <stdint.h>
+
+#include "timer.h"
+
+/* Bits 0-2 of the trigger are the input (0 is input 1), bits 4-6 the type */
+#define RULE_INPUT(trigger) ((trigger)&0x07)
+#define RULE_TYPE(trigger) (((trigger) >> 4) & 0x07)
+
+#define RULE_DISABLED 0
+/* Act once, delay_ms after the input changes to 1 (or 0) */
+#define RULE_RISING 1
+#define RULE_FALLING 2
+/* Act once the input has been 1 (or 0) for delay_ms, and keep forcing the
+ * relays for as long as it stays there */
+#define RULE_HIGH 3
+#define RULE_LOW 4
+
+/* Delays are limited to a minute, or less if they would not fit 16 bits of
+ * ticks at F_CPU */
+#define RULE_MAX_DELAY_MS                                                      \
+  (TIMER_MAX_DELAY_MS < 60000 ? TIMER_MAX_DELAY_MS : 60000)
+
+struct rule {
+  uint8_t trigger;
+  /* The relays in mask are set to the corresponding bit in state */
+  uint8_t mask;
+  uint8_t state;
+  uint16_t delay_ms;
+};
+
+struct rules_report {
+  uint8_t report_id;
+  /* Time spent evaluating the rules in the last and the slowest pass of the
+   * main loop, in units of 64 CPU cycles */
+  uint16_t cost;
+  uint16_t max_cost;
+  struct rule rules[NUM_RULES];
+};
+
+extern struct rules_report rules_report;
+
+void init_rules(void);
+
+/* Replaces rule index, both in RAM and in EEPROM */
+void rules_set(uint8_t index, struct rule const *rule);
+
+void rules_poll(uint8_t elapsed);
+
+#endif /* _RULES_H */
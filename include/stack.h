@@ -0,0 +1,27 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Stack high-water mark. The RAM between the static variables and the top of
+ * the stack is painted with a known value at boot, so the deepest the stack
+ * has ever grown can be found later by looking for the first byte that was
+ * overwritten.
+ */
+#ifndef _STACK_H
+#define _STACK_H
+
+#include <stdint.h>
+
+struct stack_report {
+  uint8_t report_id;
+  /* Bytes used by the static variables (.data, .bss and .noinit) */
+  uint16_t static_ram;
+  /* Bytes between the static variables and the deepest the stack has been */
+  uint16_t unused;
+};
+
+/* Fills in the report. Only reads memory, so it can be called at any time */
+struct stack_report *stack_snapshot(void);
+
+#endif /* _STACK_H */
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * System tick derived from Timer 0. The timer runs from the CPU clock with a
+ * /64 prescaler and overflows every 16384 cycles (~1.4 ms at 12 MHz), which
+ * advances timer_ticks. The overflow interrupt re-enables interrupts before
+ * doing anything so that it never delays the V-USB interrupt.
+ */
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_PRESCALE 64UL
+#define TIMER_TICK_CYCLES (TIMER_PRESCALE * 256UL)
+
+/* Converts milliseconds to ticks, rounding up so delays are never shortened */
+#define TIMER_MS_TO_TICKS(ms)                                                  \
+  ((uint16_t)(((ms) * (F_CPU / 1000UL) + TIMER_TICK_CYCLES - 1) /              \
+              TIMER_TICK_CYCLES))
+
+/*
+ * Converts a minimum delay in milliseconds to the starting value of a
+ * countdown decremented by timer_elapsed(). Since the first tick can arrive at
+ * any time, one extra tick is added so the delay is never shortened
+ */
+#define TIMER_DELAY_TICKS(ms)                                                  \
+  ((uint16_t)((ms) ? TIMER_MS_TO_TICKS(ms) + 1 : 0))
+
+/*
+ * Longest delay in milliseconds for which TIMER_DELAY_TICKS() fits 16 bits.
+ * This is over a minute at 16.5 MHz and below, but 53685 ms at 20 MHz
+ */
+#define TIMER_MAX_DELAY_MS (65534UL * TIMER_TICK_CYCLES / (F_CPU / 1000UL))
+
+extern volatile uint8_t timer_ticks;
+
+void timer_init(void);
+
+/*
+ * Returns a timestamp in units of the timer prescaler (64 CPU cycles), for
+ * measuring short intervals. Wraps around every 256 ticks
+ */
+uint16_t timer_stamp(void);
+
+/*
+ * Returns the number of ticks since the previous call. Must be called at
+ * least every 255 ticks, which the main loop easily does since usbPoll()
+ * has the same requirement
+ */
+uint8_t timer_elapsed(void);
+
+#endif /* _TIMER_H */
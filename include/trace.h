@@ -0,0 +1,45 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * RAM trace of recent events, for finding out what the device actually
+ * received when a host reports a problem. The last trace_entries events (a
+ * meson option) are kept in a ring buffer and read with a diagnostic report.
+ */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+/* Events other than commands. Commands are logged with their command byte as
+ * the event, and their next two bytes as the data */
+#define TRACE_BOOT 0x01      /* data[0] is the MCU reset flags */
+#define TRACE_BUS_RESET 0x02 /* The host reset the bus */
+#define TRACE_CRC_ERROR 0x03 /* data[0] is the USB token, data[1] the length */
+#define TRACE_BAD_SETUP 0x04 /* data[0] is the length of the SETUP packet */
+
+struct trace_entry {
+  /* System tick at which the event happened */
+  uint16_t time;
+  uint8_t event;
+  uint8_t data[2];
+};
+
+struct trace_report {
+  uint8_t report_id;
+  /* The current system tick, to tell the age of the entries */
+  uint16_t now;
+  /* The entry written next, which is the oldest one once the buffer is full */
+  uint8_t head;
+  /* Number of valid entries */
+  uint8_t count;
+  struct trace_entry entries[TRACE_ENTRIES];
+};
+
+extern struct trace_report trace_report;
+
+void trace_add(uint8_t event, uint8_t data0, uint8_t data1);
+void trace_poll(uint8_t elapsed);
+
+#endif /* _TRACE_H */
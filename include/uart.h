@@ -0,0 +1,59 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Command transport on the hardware USART of the ATmega, for boards on long
+ * cables or on a multi-drop RS-485 bus. The host sends frames of:
+ *
+ *   UART_SYNC, address, length, type, data[length - 1], crc_lo, crc_hi
+ *
+ * where the CRC is the Modbus CRC-16 of everything after UART_SYNC. A board
+ * handles the frames for its own address (uart_address) and for
+ * UART_BROADCAST, and answers the first with a frame of the same format, with
+ * its address and UART_REPLY added to the type. Frames to UART_BROADCAST are
+ * not answered, so that boards on a bus do not talk over each other.
+ *
+ * A frame with a bad CRC, or a gap of more than UART_GAP_MS between two of its
+ * bytes, is dropped without an answer and the host should send it again.
+ */
+#ifndef _UART_H
+#define _UART_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define UART_SYNC 0xA5
+#define UART_BROADCAST 0x00
+#define UART_REPLY 0x80
+
+/* Runs the command in the data, which is the same as the USB feature report.
+ * The answer has one byte, COMMAND_OK or COMMAND_REJECTED */
+#define UART_TYPE_COMMAND 0x01
+/* Reads the report with the ID in the first byte of the data. The answer is
+ * the report, or no data if the report is not present */
+#define UART_TYPE_GET_REPORT 0x02
+
+/* Most bytes of data in a frame to the board, which fits every command */
+#define UART_MAX_DATA 16
+
+#define UART_GAP_MS 20
+
+void init_uart(void);
+
+/* Handles the bytes received since the last call, and runs the command of a
+ * complete frame */
+void uart_poll(uint8_t elapsed);
+
+/*
+ * Sends a frame with data, which is copied, so it can change right away. Data
+ * longer than the largest report is not sent. Must not be called while
+ * uart_busy()
+ */
+void uart_send(uint8_t address, uint8_t type, uint8_t const *data,
+               uint8_t len);
+
+/* Returns true while a frame is being sent */
+bool uart_busy(void);
+
+#endif /* _UART_H */
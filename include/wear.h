@@ -0,0 +1,40 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Relay wear counters for predictive maintenance. The number of times each
+ * relay was switched on and the time it spent energized are counted in RAM,
+ * and saved to a ring of EEPROM slots in the background so that each save
+ * goes to a different slot.
+ */
+#ifndef _WEAR_H
+#define _WEAR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main.h"
+
+struct wear_counters {
+  uint32_t cycles[NUM_RELAYS];
+  /* Time energized, in seconds */
+  uint32_t on_time[NUM_RELAYS];
+};
+
+struct wear_report {
+  uint8_t report_id;
+  struct wear_counters counters;
+};
+
+extern struct wear_report wear_report;
+
+/* Loads the last saved counters. Must be called before any relay switches */
+void init_wear(void);
+
+/* Called by the relay scheduler right after the driver switches a relay */
+void wear_switched(uint8_t relay, bool on);
+
+void wear_poll(uint8_t elapsed);
+
+#endif /* _WEAR_H */
@@ -0,0 +1,100 @@
+#! /usr/bin/env python3
+#
+# Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+#
+# SPDX-License-Identifier: GPL-2.0
+#
+# Helpers for analysing the AVR disassembly printed by "objdump -d" (or -S)
+
+import re
+import subprocess
+from dataclasses import dataclass, field
+
+FUNC_RE = re.compile(r"^([0-9a-f]+) <([^>]+)>:$")
+INSN_RE = re.compile(r"^\s+([0-9a-f]+):\t([0-9a-f ]+?)\s*\t(\S+)\s*([^;]*?)\s*(?:;\s*(.*))?$")
+TARGET_RE = re.compile(r"<([^>+]+)(\+0x[0-9a-f]+)?>")
+ADDR_RE = re.compile(r"^0x([0-9a-f]+)")
+
+# RAM size in bytes of the supported parts
+RAM_SIZE = {
+    "attiny25": 128,
+    "attiny45": 256,
+    "attiny85": 512,
+    "attiny261": 128,
+    "attiny461": 256,
+    "attiny861": 512,
+    "atmega8": 1024,
+    "atmega8a": 1024,
+}
+
+# Bytes pushed for the return address of a call or an interrupt on the
+# supported parts (all have less than 128 KB of flash)
+RETURN_ADDRESS_SIZE = 2
+
+
+@dataclass
+class Insn:
+    addr: int
+    size: int
+    mnemonic: str
+    operands: str
+    comment: str
+
+    def target(self):
+        """Returns (function, offset) of the target of a jump or call, or None"""
+        m = TARGET_RE.search(self.comment or self.operands)
+        if not m:
+            return None
+        return m.group(1), int(m.group(2)[1:], 16) if m.group(2) else 0
+
+    def target_addr(self):
+        """Returns the absolute address of the target of a jump or call, or None"""
+        m = ADDR_RE.match(self.comment) or ADDR_RE.match(self.operands)
+        if not m:
+            return None
+        return int(m.group(1), 16)
+
+
+@dataclass
+class Function:
+    name: str
+    addr: int
+    insns: list = field(default_factory=list)
+
+    def pushes(self):
+        return sum(1 for i in self.insns if i.mnemonic == "push")
+
+
+def disassemble(objdump, elf):
+    return subprocess.run(
+        [objdump, "-d", elf], check=True, capture_output=True, text=True
+    ).stdout
+
+
+def parse(text):
+    """Parses objdump output into a dictionary of Functions by name"""
+    functions = {}
+    current = None
+    for line in text.splitlines():
+        m = FUNC_RE.match(line)
+        if m:
+            current = Function(m.group(2), int(m.group(1), 16))
+            functions[current.name] = current
+            continue
+
+        m = INSN_RE.match(line)
+        if m and current is not None:
+            current.insns.append(
+                Insn(
+                    int(m.group(1), 16),
+                    len(m.group(2).split()),
+                    m.group(3),
+                    m.group(4),
+                    m.group(5) or "",
+                )
+            )
+    return functions
+
+
+def is_isr(name):
+    return re.match(r"^__vector_[0-9]+$", name) is not None and name != "__vector_default"
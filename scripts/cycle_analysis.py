@@ -0,0 +1,312 @@
+#! /usr/bin/env python3
+#
+# Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+#
+# SPDX-License-Identifier: GPL-2.0
+#
+# Finds the worst case number of cycles that interrupts stay disabled, which
+# delays the V-USB interrupt. V-USB only tolerates a short delay (about 25
+# cycles), so every region must fit the budget except the ones that are long
+# by design. These are:
+#   - The handlers allowed by name, which is only the USB interrupt itself
+#   - Regions in code that only runs from the V-USB reset hook, which is called
+#     while the bus comes out of reset and the host sends no packets. This is
+#     how the oscillator calibration runs. The call graph is checked, so a
+#     region is only allowed if no other path can reach it
+#
+# The regions are:
+#   - Every interrupt handler, from the interrupt until it re-enables
+#     interrupts with "sei" (ISR_NOBLOCK) or returns
+#   - Every "cli" in other code, until the following "sei" or write to SREG
+#     (which is how ATOMIC_BLOCK ends), or until the function returns
+#
+# The worst case path is found over all branches. Called functions are counted
+# in full. Paths with loops or indirect jumps are unbounded.
+
+import argparse
+import sys
+
+import avrasm
+
+# Cycles from the interrupt to the first instruction of the handler: the
+# interrupt response plus the jump in the vector table
+INTERRUPT_ENTRY = 4 + 3
+
+SREG = 0x3F
+
+CYCLES = {
+    "adiw": 2,
+    "sbiw": 2,
+    "mul": 2,
+    "muls": 2,
+    "mulsu": 2,
+    "fmul": 2,
+    "fmuls": 2,
+    "fmulsu": 2,
+    "ld": 2,
+    "ldd": 2,
+    "lds": 2,
+    "st": 2,
+    "std": 2,
+    "sts": 2,
+    "push": 2,
+    "pop": 2,
+    "sbi": 2,
+    "cbi": 2,
+    "rjmp": 2,
+    "ijmp": 2,
+    "jmp": 3,
+    "rcall": 3,
+    "icall": 3,
+    "lpm": 3,
+    "elpm": 3,
+    "call": 4,
+    "ret": 4,
+    "reti": 4,
+}
+
+SKIPS = ("cpse", "sbrc", "sbrs", "sbic", "sbis")
+
+UNBOUNDED = float("inf")
+
+
+def is_branch(mnemonic):
+    return mnemonic.startswith("br")
+
+
+def ends_region(insn):
+    if insn.mnemonic == "sei":
+        return True
+    if insn.mnemonic == "out":
+        port = insn.operands.split(",")[0].strip()
+        return int(port, 0) == SREG
+    return False
+
+
+class Analyzer(object):
+    def __init__(self, functions):
+        self.functions = functions
+        self.by_addr = {}
+        self.owner = {}
+        for f in functions.values():
+            for i in f.insns:
+                self.by_addr[i.addr] = i
+                self.owner[i.addr] = f
+        self.body_cycles = {}
+        self.callers = {}
+        for f in functions.values():
+            for i in f.insns:
+                if i.mnemonic not in ("call", "rcall", "jmp", "rjmp"):
+                    continue
+                callee = self.owner.get(i.target_addr())
+                if callee is not None and callee is not f:
+                    self.callers.setdefault(callee.name, set()).add(f.name)
+
+    def only_called_from(self, name, root, stack=()):
+        """
+        True if every direct call or jump to name is from root or from code
+        that is itself only called from root. Functions that are never called
+        directly (interrupt handlers, or through a pointer) are not
+        """
+        if name == root:
+            return True
+        callers = self.callers.get(name)
+        if not callers or name in stack:
+            return False
+        return all(self.only_called_from(c, root, stack + (name,)) for c in callers)
+
+    def calls(self, addr, f, stop):
+        """Names of the functions called from addr until the end of the region"""
+        names = set()
+        todo = [addr]
+        seen = set()
+        while todo:
+            a = todo.pop()
+            insn = self.by_addr.get(a)
+            if a in seen or insn is None or self.owner[a] is not f:
+                continue
+            seen.add(a)
+            m = insn.mnemonic
+            nxt = a + insn.size
+            target = insn.target_addr()
+            callee = self.owner.get(target)
+            if stop(insn) or m in ("ret", "reti"):
+                continue
+            if m in ("call", "rcall", "jmp", "rjmp") and callee is not f:
+                if callee is not None:
+                    names.add(callee.name)
+                if m in ("call", "rcall"):
+                    todo.append(nxt)
+                continue
+            if m in ("jmp", "rjmp"):
+                todo.append(target)
+                continue
+            todo.append(nxt)
+            if is_branch(m) and target is not None:
+                todo.append(target)
+            elif m in SKIPS:
+                skipped = self.by_addr.get(nxt)
+                if skipped is not None:
+                    todo.append(nxt + skipped.size)
+        return names
+
+    def body(self, name, stack=()):
+        """Worst case cycles of a whole function, from its entry to its return"""
+        if name in self.body_cycles:
+            return self.body_cycles[name]
+        f = self.functions.get(name)
+        if f is None or not f.insns or name in stack:
+            return UNBOUNDED
+        c = self.path(f.insns[0].addr, f, stop=None, stack=stack + (name,))
+        self.body_cycles[name] = c
+        return c
+
+    def path(self, addr, f, stop, stack, visiting=None, memo=None):
+        """
+        Worst case cycles from addr to the end of the region (stop(insn)
+        returns True) or the return of f
+        """
+        if visiting is None:
+            visiting = set()
+            memo = {}
+        if addr in memo:
+            return memo[addr]
+        if addr in visiting:
+            # Loop
+            return UNBOUNDED
+        insn = self.by_addr.get(addr)
+        if insn is None or self.owner[addr] is not f:
+            return UNBOUNDED
+
+        visiting.add(addr)
+        cost = CYCLES.get(insn.mnemonic, 1)
+        nxt = addr + insn.size
+        m = insn.mnemonic
+
+        def follow(a):
+            return self.path(a, f, stop, stack, visiting, memo)
+
+        if stop is not None and stop(insn):
+            result = cost
+        elif m in ("ret", "reti"):
+            result = cost
+        elif m in ("ijmp", "eijmp", "icall", "eicall"):
+            result = UNBOUNDED
+        elif m in ("call", "rcall"):
+            target = insn.target_addr()
+            if target is not None and self.owner.get(target) is f:
+                # "rcall .+0" allocates stack space
+                result = cost + follow(nxt)
+            else:
+                callee = self.owner.get(target)
+                result = cost + (self.body(callee.name, stack) if callee else UNBOUNDED) + follow(nxt)
+        elif m in ("jmp", "rjmp"):
+            target = insn.target_addr()
+            if target is not None and self.owner.get(target) is f:
+                result = cost + follow(target)
+            else:
+                # Tail call
+                callee = self.owner.get(target)
+                result = cost + (self.body(callee.name, stack) if callee else UNBOUNDED)
+        elif is_branch(m):
+            target = insn.target_addr()
+            result = max(cost + follow(nxt), cost + 1 + follow(target))
+        elif m in SKIPS:
+            skipped = self.by_addr.get(nxt)
+            result = cost + follow(nxt)
+            if skipped is not None:
+                result = max(result, cost + skipped.size // 2 + follow(nxt + skipped.size))
+        else:
+            result = cost + follow(nxt)
+
+        visiting.discard(addr)
+        memo[addr] = result
+        return result
+
+    def regions(self):
+        """
+        Yields (function, address, cycles, start) for every interrupts disabled
+        region, where start is the address of its first instruction
+        """
+        for f in self.functions.values():
+            if not f.insns:
+                continue
+            if avrasm.is_isr(f.name):
+                yield f, f.addr, INTERRUPT_ENTRY + self.path(f.addr, f, ends_region, (f.name,)), f.addr
+                continue
+            for i in f.insns:
+                if i.mnemonic == "cli":
+                    nxt = i.addr + i.size
+                    yield f, i.addr, 1 + self.path(nxt, f, ends_region, (f.name,)), nxt
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Check how long interrupts are disabled in the firmware"
+    )
+    parser.add_argument("--asm", help="objdump disassembly of the firmware", required=True)
+    parser.add_argument(
+        "--budget",
+        type=int,
+        default=25,
+        help="Maximum cycles interrupts may be disabled (Default is %(default)s)",
+    )
+    parser.add_argument(
+        "--allow",
+        action="append",
+        default=[],
+        help="Function whose regions may exceed the budget. May be repeated",
+    )
+    parser.add_argument(
+        "--reset-hook",
+        default="usbEventResetReady",
+        help="Function called by V-USB when the bus comes out of reset (Default is %(default)s)",
+    )
+    parser.add_argument("--output", help="Output report", required=True)
+    args = parser.parse_args()
+
+    with open(args.asm) as f:
+        functions = avrasm.parse(f.read())
+
+    analyzer = Analyzer(functions)
+    lines = [f"Budget: {args.budget} cycles"]
+    failed = []
+    for f, addr, cycles, start in sorted(analyzer.regions(), key=lambda r: r[1]):
+        kind = "isr" if avrasm.is_isr(f.name) else "cli"
+        text = "unbounded" if cycles == UNBOUNDED else str(cycles)
+        status = ""
+        if cycles > args.budget:
+            if f.name in args.allow:
+                status = " (allowed)"
+            elif kind == "cli" and analyzer.only_called_from(f.name, args.reset_hook):
+                status = " (bus in reset)"
+            else:
+                status = " OVER BUDGET"
+                failed.append(f.name)
+        lines.append(f"{kind} 0x{addr:04x} {f.name}: {text}{status}")
+
+        if status == " (bus in reset)":
+            called = sorted(analyzer.calls(start, f, ends_region))
+            lines.append("    calls: " + (", ".join(called) if called else "nothing"))
+
+        if kind == "isr":
+            total = analyzer.body(f.name)
+            total_text = "unbounded" if total == UNBOUNDED else str(INTERRUPT_ENTRY + total)
+            lines.append(f"    whole handler: {total_text}")
+
+    report = "\n".join(lines) + "\n"
+    with open(args.output, "w") as f:
+        f.write(report)
+    sys.stdout.write(report)
+
+    if failed:
+        print(
+            "error: interrupts are disabled for too long in: " + ", ".join(sorted(set(failed))),
+            file=sys.stderr,
+        )
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,51 @@
+#! /usr/bin/env python3
+#
+# Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+#
+# SPDX-License-Identifier: GPL-2.0
+#
+# Reads and writes the Intel hex files made by objcopy
+
+
+def read(path):
+    """Reads an Intel hex file into a bytearray starting at address 0. Gaps are
+    filled with 0xFF, the erased value of flash and EEPROM"""
+    image = bytearray()
+    base = 0
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            if not line.startswith(":"):
+                raise Exception(f"{path}: invalid line {line!r}")
+            record = bytes.fromhex(line[1:])
+            if sum(record) & 0xFF:
+                raise Exception(f"{path}: bad checksum in {line!r}")
+            length, addr, kind = record[0], (record[1] << 8) | record[2], record[3]
+            data = record[4 : 4 + length]
+            if kind == 0:
+                addr += base
+                if len(image) < addr + length:
+                    image.extend(b"\xff" * (addr + length - len(image)))
+                image[addr : addr + length] = data
+            elif kind == 1:
+                break
+            elif kind == 2:
+                base = ((data[0] << 8) | data[1]) << 4
+            elif kind == 4:
+                base = ((data[0] << 8) | data[1]) << 16
+    return image
+
+
+def record(addr, kind, data):
+    r = bytes([len(data), (addr >> 8) & 0xFF, addr & 0xFF, kind]) + bytes(data)
+    return ":" + (r + bytes([-sum(r) & 0xFF])).hex().upper() + "\n"
+
+
+def write(path, image):
+    """Writes image, starting at address 0, to an Intel hex file"""
+    with open(path, "w") as f:
+        for addr in range(0, len(image), 16):
+            f.write(record(addr, 0, image[addr : addr + 16]))
+        f.write(record(0, 1, b""))
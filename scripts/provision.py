@@ -0,0 +1,281 @@
+#! /usr/bin/env python3
+#
+# Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+#
+# SPDX-License-Identifier: GPL-2.0
+#
+# Programs a batch of boards with several ISP programmers at once, giving each
+# board the next serial number of a range in its EEPROM image. Each
+# programmer waits for a board to answer, programs and verifies it, records
+# it in the manifest, and waits for it to be removed before starting on the
+# next one, so the operator only has to swap boards.
+#
+# A board is given the lowest serial number left when it answers, so a
+# programmer that never gets a board doesn't hold one back, and the serial
+# number of a board that fails goes to the next board on any programmer.
+
+import argparse
+import csv
+import datetime
+import hashlib
+import heapq
+import pathlib
+import subprocess
+import sys
+import threading
+import time
+
+import ihex
+
+SERIAL_LEN = 5
+# Address of the EEPROM in the address space of the ELF file
+EEPROM_BASE = 0x810000
+
+MANIFEST_FIELDS = ["serial", "programmer", "time", "flash_sha256", "eeprom", "result"]
+
+
+def serial_offset(nm, elf):
+    output = subprocess.run([nm, elf], check=True, capture_output=True, text=True).stdout
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[2] == "serial":
+            return int(fields[0], 16) - EEPROM_BASE
+    raise Exception(f"{elf} has no serial number")
+
+
+def serial_range(first, count):
+    """Counts up the decimal digits at the end of first"""
+    prefix = first.rstrip("0123456789")
+    digits = first[len(prefix) :]
+    if len(first) != SERIAL_LEN or not digits:
+        raise Exception(f"{first!r} must be {SERIAL_LEN} characters ending in digits")
+    start = int(digits)
+    if start + count > 10 ** len(digits):
+        raise Exception(f"Not enough serial numbers after {first}")
+    return [f"{prefix}{n:0{len(digits)}d}" for n in range(start, start + count)]
+
+
+def make_image(base, offset, serial, path):
+    image = bytearray(base)
+    if len(image) < offset + SERIAL_LEN:
+        image.extend(b"\xff" * (offset + SERIAL_LEN - len(image)))
+    image[offset : offset + SERIAL_LEN] = serial.encode("ascii")
+    ihex.write(path, image)
+
+
+class Programmer(object):
+    def __init__(self, spec, args):
+        # TYPE:PORT, where the port may itself contain colons
+        self.type, _, self.port = spec.partition(":")
+        self.name = spec
+        self.args = args
+
+    def avrdude(self, *extra, bitclock=None):
+        cmd = [
+            self.args.avrdude,
+            "-c",
+            self.type,
+            "-p",
+            self.args.part,
+            "-B",
+            bitclock or self.args.bitclock,
+            "-q",
+            "-q",
+        ]
+        if self.port:
+            cmd += ["-P", self.port]
+        return subprocess.run(
+            cmd + list(extra), stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True
+        )
+
+    def present(self):
+        # With no operations, avrdude only reads the device signature. Use the
+        # slow clock, since a new chip still runs from its internal oscillator
+        return self.avrdude(bitclock="100").returncode == 0
+
+    def wait(self, present):
+        while self.present() != present:
+            time.sleep(self.args.poll)
+
+    def program(self, eeprom):
+        if self.args.fuses:
+            p = self.avrdude(*self.args.fuses, bitclock="100")
+            if p.returncode != 0:
+                return p
+        # avrdude reads back and verifies every memory it writes
+        return self.avrdude(
+            "-e",
+            "-U",
+            f"flash:w:{self.args.flash}:i",
+            "-U",
+            f"eeprom:w:{eeprom}:i",
+        )
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Program a batch of boards with unique serial numbers")
+    parser.add_argument("--first", help="First serial number, e.g. R0001", required=True)
+    parser.add_argument("--count", type=int, help="Number of boards", required=True)
+    parser.add_argument(
+        "--build-dir",
+        type=pathlib.Path,
+        default=pathlib.Path("build"),
+        help="Build directory of the firmware (Default is %(default)s)",
+    )
+    parser.add_argument(
+        "--flash",
+        type=pathlib.Path,
+        help="Flash image (Default is hidrelay.hex in the build directory)",
+    )
+    parser.add_argument(
+        "--output-dir",
+        type=pathlib.Path,
+        default=pathlib.Path("provision"),
+        help="Directory for the EEPROM images and the manifest (Default is %(default)s)",
+    )
+    parser.add_argument(
+        "--programmer",
+        action="append",
+        default=[],
+        help="avrdude programmer as TYPE:PORT, e.g. avrispmkII:usb:000200012345. May be repeated",
+    )
+    parser.add_argument("--part", help="avrdude part, e.g. t45 or m8")
+    parser.add_argument(
+        "--bitclock", default="1.1", help="avrdude bit clock period (Default is %(default)s)"
+    )
+    parser.add_argument("--fuses", action="store_true", help="Also write the fuses from fuses.txt")
+    parser.add_argument("--avrdude", default="avrdude", help="avrdude program (Default is %(default)s)")
+    parser.add_argument("--nm", default="avr-nm", help="nm program (Default is %(default)s)")
+    parser.add_argument(
+        "--poll",
+        type=float,
+        default=0.5,
+        help="Seconds between checks for a board (Default is %(default)s)",
+    )
+    parser.add_argument(
+        "--images-only",
+        action="store_true",
+        help="Only write the EEPROM images, without programming any boards",
+    )
+    args = parser.parse_args()
+
+    serials = serial_range(args.first, args.count)
+    args.flash = args.flash or args.build_dir / "hidrelay.hex"
+    offset = serial_offset(args.nm, args.build_dir / "hidrelay")
+    base = ihex.read(args.build_dir / "hidrelay.ee.hex")
+
+    args.output_dir.mkdir(parents=True, exist_ok=True)
+    images = {}
+    for s in serials:
+        images[s] = args.output_dir / f"{s}.ee.hex"
+        make_image(base, offset, s, images[s])
+
+    if args.images_only:
+        print(f"Wrote {len(images)} EEPROM images to {args.output_dir}")
+        return 0
+
+    if not args.programmer or not args.part:
+        print("--programmer and --part are needed to program boards", file=sys.stderr)
+        return 1
+
+    if args.fuses:
+        # fuses.txt has "-p PART -B 100 -U lfuse:w:..."; keep only the writes
+        words = (args.build_dir / "fuses.txt").read_text().split()
+        args.fuses = [w for i, w in enumerate(words) if w == "-U" or (i > 0 and words[i - 1] == "-U")]
+
+    flash_sha256 = hashlib.sha256(args.flash.read_bytes()).hexdigest()
+    manifest_path = args.output_dir / "manifest.csv"
+    new_manifest = not manifest_path.exists()
+    manifest = open(manifest_path, "a", newline="")
+    writer = csv.DictWriter(manifest, fieldnames=MANIFEST_FIELDS)
+    if new_manifest:
+        writer.writeheader()
+    lock = threading.Lock()
+
+    # Serial numbers not given to a board yet, lowest first, and the number
+    # of boards being programmed, whose serial numbers come back if they fail
+    pending = list(serials)
+    heapq.heapify(pending)
+    in_progress = [0]
+    done = []
+
+    def record(serial, programmer, result):
+        with lock:
+            writer.writerow(
+                {
+                    "serial": serial,
+                    "programmer": programmer.name,
+                    "time": datetime.datetime.now().isoformat(timespec="seconds"),
+                    "flash_sha256": flash_sha256,
+                    "eeprom": images[serial].name,
+                    "result": result,
+                }
+            )
+            manifest.flush()
+
+    def take():
+        """
+        Returns the lowest serial number left, None if the others are all on
+        boards being programmed, or "" once every board is done
+        """
+        with lock:
+            if pending:
+                in_progress[0] += 1
+                return heapq.heappop(pending)
+            return None if in_progress[0] else ""
+
+    def give_back(serial, ok):
+        with lock:
+            in_progress[0] -= 1
+            if ok:
+                done.append(serial)
+            else:
+                heapq.heappush(pending, serial)
+
+    def worker(programmer):
+        print(f"{programmer.name}: waiting for a board")
+        while True:
+            if not programmer.present():
+                with lock:
+                    if not pending and not in_progress[0]:
+                        return
+                time.sleep(args.poll)
+                continue
+
+            serial = take()
+            if serial == "":
+                print(f"{programmer.name}: no serial numbers left, remove the board")
+                return
+            if serial is None:
+                # Wait for the boards on the other programmers, in case one
+                # fails and its serial number comes back
+                time.sleep(args.poll)
+                continue
+
+            p = programmer.program(images[serial])
+            ok = p.returncode == 0
+            record(serial, programmer, "ok" if ok else "failed")
+            give_back(serial, ok)
+            if ok:
+                print(f"{programmer.name}: programmed {serial}, remove the board")
+            else:
+                print(
+                    f"{programmer.name}: failed to program {serial}, remove the board:\n{p.stdout}",
+                    file=sys.stderr,
+                )
+            programmer.wait(False)
+            print(f"{programmer.name}: waiting for a board")
+
+    threads = [threading.Thread(target=worker, args=(Programmer(p, args),)) for p in args.programmer]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    manifest.close()
+
+    print(f"Programmed {len(done)} boards; manifest is {manifest_path}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,160 @@
+#! /usr/bin/env python3
+#
+# Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+#
+# SPDX-License-Identifier: GPL-2.0
+#
+# Checks that the static variables plus the worst case stack depth fit in the
+# RAM of the device. The stack depth is found by walking the call graph in the
+# disassembly, using the frame sizes that gcc reports with -fstack-usage, or
+# the number of pushes for code that has none (assembly and libgcc). Since
+# interrupts other than V-USB re-enable interrupts, the worst case is taken to
+# be the deepest path from main() with every interrupt handler nested on top.
+
+import argparse
+import pathlib
+import subprocess
+import sys
+
+import avrasm
+
+
+def read_stack_usage(su_dir):
+    usage = {}
+    for path in pathlib.Path(su_dir).rglob("*.su"):
+        for line in path.read_text().splitlines():
+            location, size, qualifiers = line.split("\t")
+            name = location.split(":")[-1]
+            if "dynamic" in qualifiers and "bounded" not in qualifiers:
+                print(f"warning: {name} has an unbounded dynamic stack size", file=sys.stderr)
+            # Static functions in different files can share a name
+            usage[name] = max(usage.get(name, 0), int(size))
+    return usage
+
+
+def read_static_ram(size, elf):
+    output = subprocess.run(
+        [size, "-A", elf], check=True, capture_output=True, text=True
+    ).stdout
+    sections = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith("."):
+            sections[fields[0]] = int(fields[1])
+    return sum(sections.get(s, 0) for s in (".data", ".bss", ".noinit"))
+
+
+class CallGraph(object):
+    def __init__(self, functions, usage):
+        self.functions = functions
+        self.usage = usage
+        self.depths = {}
+        self.paths = {}
+        self.indirect = set()
+
+    def frame(self, f):
+        # "rcall .+0" to itself is how gcc allocates 2 bytes of frame
+        self_calls = sum(
+            1
+            for i in f.insns
+            if i.mnemonic in ("call", "rcall") and i.target() and i.target()[0] == f.name
+        )
+        return max(self.usage.get(f.name, 0), f.pushes() + self_calls * avrasm.RETURN_ADDRESS_SIZE)
+
+    def depth(self, name, stack=()):
+        if name in self.depths:
+            return self.depths[name]
+        if name in stack:
+            raise Exception("Recursion is not supported: " + " -> ".join(stack + (name,)))
+
+        f = self.functions.get(name)
+        if f is None:
+            return 0
+
+        best = 0
+        best_path = []
+        for i in f.insns:
+            if i.mnemonic in ("icall", "eicall", "ijmp", "eijmp"):
+                self.indirect.add(name)
+                continue
+
+            target = i.target()
+            if target is None or target[0] == name:
+                continue
+
+            if i.mnemonic in ("call", "rcall"):
+                d = avrasm.RETURN_ADDRESS_SIZE + self.depth(target[0], stack + (name,))
+            elif i.mnemonic in ("jmp", "rjmp") and target[1] == 0:
+                # Tail call
+                d = self.depth(target[0], stack + (name,))
+            else:
+                continue
+
+            if d > best:
+                best = d
+                best_path = [target[0]] + self.paths.get(target[0], [])
+
+        self.depths[name] = self.frame(f) + best
+        self.paths[name] = best_path
+        return self.depths[name]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check the RAM budget of the firmware")
+    parser.add_argument("--cpu", help="CPU", required=True)
+    parser.add_argument("--elf", help="Firmware ELF file", required=True)
+    parser.add_argument("--objdump", help="objdump program", required=True)
+    parser.add_argument("--size", help="size program", required=True)
+    parser.add_argument("--su-dir", help="Directory to search for .su files", required=True)
+    parser.add_argument(
+        "--margin",
+        type=int,
+        default=16,
+        help="Bytes that must remain free (Default is %(default)s)",
+    )
+    parser.add_argument("--output", help="Output report", required=True)
+    args = parser.parse_args()
+
+    if args.cpu not in avrasm.RAM_SIZE:
+        print(f"Unknown RAM size for {args.cpu}", file=sys.stderr)
+        return 1
+
+    ram = avrasm.RAM_SIZE[args.cpu]
+    static_ram = read_static_ram(args.size, args.elf)
+    functions = avrasm.parse(avrasm.disassemble(args.objdump, args.elf))
+    graph = CallGraph(functions, read_stack_usage(args.su_dir))
+
+    # main() is called from the C runtime
+    main_depth = avrasm.RETURN_ADDRESS_SIZE + graph.depth("main")
+    isrs = sorted(n for n in functions if avrasm.is_isr(n))
+    isr_depths = {n: avrasm.RETURN_ADDRESS_SIZE + graph.depth(n) for n in isrs}
+    stack = main_depth + sum(isr_depths.values())
+    free = ram - static_ram - stack
+
+    lines = [
+        f"RAM:             {ram}",
+        f"Static:          {static_ram}",
+        f"Stack (main):    {main_depth} via {' -> '.join(['main'] + graph.paths['main'])}",
+    ]
+    for n in isrs:
+        lines.append(f"Stack ({n}): {isr_depths[n]}")
+    lines.append(f"Free:            {free} (margin {args.margin})")
+    for n in sorted(graph.indirect):
+        lines.append(f"warning: {n} makes indirect calls, which are not counted")
+    report = "\n".join(lines) + "\n"
+
+    with open(args.output, "w") as f:
+        f.write(report)
+    sys.stdout.write(report)
+
+    if free < args.margin:
+        print(
+            f"error: RAM budget exceeded by {args.margin - free} bytes",
+            file=sys.stderr,
+        )
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
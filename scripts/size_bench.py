@@ -0,0 +1,210 @@
+#! /usr/bin/env python3
+#
+# Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+#
+# SPDX-License-Identifier: GPL-2.0
+#
+# Builds the firmware for every board and compares the flash, RAM and EEPROM
+# usage against the baseline recorded in size_baseline.json. The build fails
+# if a board no longer fits its budget, and the change from the baseline is
+# printed so that the cost of each change can be seen for every board. Run
+# with --update to record the current sizes as the new baseline, or with
+# --output to write them to another file. Boards with no recorded sizes are
+# only checked against their budget, unless --require-baseline is given.
+
+import argparse
+import concurrent.futures
+import json
+import pathlib
+import subprocess
+import sys
+
+ROOT = pathlib.Path(__file__).resolve().parent.parent
+SECTIONS = (".text", ".data", ".bss", ".noinit", ".eeprom")
+
+
+def read_sizes(size, elf):
+    output = subprocess.run(
+        [size, "-A", str(elf)], check=True, capture_output=True, text=True
+    ).stdout
+    sections = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0] in SECTIONS:
+            sections[fields[0]] = int(fields[1])
+    return {
+        "text": sections.get(".text", 0),
+        "data": sections.get(".data", 0),
+        "bss": sections.get(".bss", 0) + sections.get(".noinit", 0),
+        "eeprom": sections.get(".eeprom", 0),
+    }
+
+
+def usage(sizes):
+    # The initial values of .data are stored in flash
+    return {
+        "flash": sizes["text"] + sizes["data"],
+        "ram": sizes["data"] + sizes["bss"],
+        "eeprom": sizes["eeprom"],
+    }
+
+
+def build(name, board, build_dir, size):
+    path = build_dir / name.replace(" ", "_")
+    if (path / "build.ninja").exists():
+        setup = ["meson", "setup", "--reconfigure"]
+    else:
+        setup = ["meson", "setup"]
+    for c in board["cross"]:
+        setup.append("--cross-file=" + str(ROOT / c))
+    setup.extend(board.get("options", []))
+    setup.extend([str(path), str(ROOT)])
+
+    for cmd in (setup, ["ninja", "-C", str(path), "hidrelay"]):
+        p = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        if p.returncode != 0:
+            raise Exception(f"{name}: {' '.join(cmd)} failed:\n{p.stdout}")
+
+    return read_sizes(size, path / "hidrelay")
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Check the flash, RAM and EEPROM usage of every board"
+    )
+    parser.add_argument(
+        "--baseline",
+        type=pathlib.Path,
+        default=ROOT / "scripts" / "size_baseline.json",
+        help="Baseline file (Default is %(default)s)",
+    )
+    parser.add_argument(
+        "--build-dir",
+        type=pathlib.Path,
+        default=pathlib.Path("size-build"),
+        help="Directory for the builds (Default is %(default)s)",
+    )
+    parser.add_argument(
+        "--size", default="avr-size", help="size program (Default is %(default)s)"
+    )
+    parser.add_argument(
+        "--jobs", "-j", type=int, default=None, help="Number of boards to build at once"
+    )
+    parser.add_argument(
+        "--board",
+        action="append",
+        default=[],
+        help="Only build this board. May be repeated",
+    )
+    parser.add_argument(
+        "--max-growth",
+        type=int,
+        default=None,
+        help="Also fail if the flash usage of a board grows by more than this many bytes",
+    )
+    parser.add_argument(
+        "--require-baseline",
+        action="store_true",
+        help="Fail if a board has no sizes recorded in the baseline",
+    )
+    parser.add_argument(
+        "--update", action="store_true", help="Record the sizes as the new baseline"
+    )
+    parser.add_argument(
+        "--output",
+        type=pathlib.Path,
+        default=None,
+        help="Write the baseline with the measured sizes to this file",
+    )
+    args = parser.parse_args()
+
+    baseline = json.loads(args.baseline.read_text())
+    measured = json.loads(args.baseline.read_text())
+    boards = {n: b for n, b in baseline.items() if not args.board or n in args.board}
+    for n in args.board:
+        if n not in baseline:
+            print(f"Unknown board {n}", file=sys.stderr)
+            return 1
+
+    results = {}
+    errors = []
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.jobs) as executor:
+        futures = {
+            executor.submit(build, n, b, args.build_dir, args.size): n
+            for n, b in boards.items()
+        }
+        for future in concurrent.futures.as_completed(futures):
+            try:
+                results[futures[future]] = future.result()
+            except Exception as e:
+                errors.append(str(e))
+
+    for e in errors:
+        print(e, file=sys.stderr)
+
+    print(
+        f"{'Board':<28} {'text':>6} {'data':>5} {'bss':>5} {'eeprom':>6}"
+        f"  {'flash':>15} {'ram':>15} {'eeprom':>15}"
+    )
+    failed = []
+    missing = []
+    for name in sorted(results):
+        sizes = results[name]
+        board = boards[name]
+        used = usage(sizes)
+        old = usage(board["size"]) if board.get("size") else None
+        if old is None:
+            missing.append(name)
+
+        columns = []
+        for k in ("flash", "ram", "eeprom"):
+            text = f"{used[k]}/{board['budget'][k]}"
+            if old is not None and used[k] != old[k]:
+                text += f" ({used[k] - old[k]:+})"
+            columns.append(text)
+
+            if used[k] > board["budget"][k]:
+                failed.append(f"{name}: {k} is {used[k]} bytes, budget is {board['budget'][k]}")
+
+        if (
+            args.max_growth is not None
+            and old is not None
+            and used["flash"] - old["flash"] > args.max_growth
+        ):
+            failed.append(
+                f"{name}: flash grew by {used['flash'] - old['flash']} bytes, "
+                f"limit is {args.max_growth}"
+            )
+
+        print(
+            f"{name:<28} {sizes['text']:>6} {sizes['data']:>5} {sizes['bss']:>5} "
+            f"{sizes['eeprom']:>6}  " + " ".join(f"{c:>15}" for c in columns)
+        )
+
+        measured[name]["size"] = sizes
+        if args.update:
+            board["size"] = sizes
+
+    if missing and not args.update:
+        message = "no baseline recorded for: " + ", ".join(missing)
+        if args.require_baseline:
+            failed.append(message)
+        else:
+            print("warning: " + message, file=sys.stderr)
+
+    for f in failed:
+        print("error: " + f, file=sys.stderr)
+
+    if args.update and not errors:
+        args.baseline.write_text(json.dumps(baseline, indent=2) + "\n")
+    if args.output is not None:
+        args.output.parent.mkdir(parents=True, exist_ok=True)
+        args.output.write_text(json.dumps(measured, indent=2) + "\n")
+
+    if errors or failed:
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
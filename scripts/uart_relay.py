@@ -0,0 +1,156 @@
+#! /usr/bin/env python3
+#
+# Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+#
+# SPDX-License-Identifier: GPL-2.0
+#
+# Sends commands to boards on a serial port or RS-485 bus with the UART
+# transport (see include/uart.h), and reads their reports.
+#
+# Needs pyserial.
+
+import argparse
+import sys
+
+import serial
+
+UART_SYNC = 0xA5
+UART_BROADCAST = 0x00
+UART_REPLY = 0x80
+
+UART_TYPE_COMMAND = 0x01
+UART_TYPE_GET_REPORT = 0x02
+
+COMMAND_OK = 0x01
+
+CMD_ON = 0xFF
+CMD_OFF = 0xFD
+CMD_ALL_ON = 0xFE
+CMD_ALL_OFF = 0xFC
+CMD_SET_MASK = 0xF9
+
+REPORT_ID_RELAYS = 0
+
+RETRIES = 3
+
+
+def crc16(data):
+    """Modbus CRC-16"""
+    crc = 0xFFFF
+    for b in data:
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def frame(address, kind, data):
+    body = bytes([address, len(data) + 1, kind]) + bytes(data)
+    crc = crc16(body)
+    return bytes([UART_SYNC]) + body + bytes([crc & 0xFF, crc >> 8])
+
+
+class Bus(object):
+    def __init__(self, port, baud, timeout):
+        self.port = serial.Serial(port, baud, timeout=timeout)
+
+    def read_frame(self):
+        while True:
+            b = self.port.read(1)
+            if not b:
+                return None
+            if b[0] != UART_SYNC:
+                continue
+            head = self.port.read(2)
+            if len(head) != 2 or head[1] == 0:
+                return None
+            rest = self.port.read(head[1] + 2)
+            if len(rest) != head[1] + 2 or crc16(head + rest) != 0:
+                return None
+            return head[0], rest[0], rest[1:-2]
+
+    def request(self, address, kind, data):
+        for _ in range(RETRIES):
+            self.port.reset_input_buffer()
+            self.port.write(frame(address, kind, data))
+            if address == UART_BROADCAST:
+                return None
+            while True:
+                reply = self.read_frame()
+                if reply is None:
+                    break
+                # The request itself comes back on a bus that echoes
+                if reply[0] == address and reply[1] == kind | UART_REPLY:
+                    return reply[2]
+        raise Exception(f"no answer from board {address}")
+
+    def command(self, address, data):
+        reply = self.request(address, UART_TYPE_COMMAND, data)
+        if reply is not None and reply != bytes([COMMAND_OK]):
+            raise Exception(f"board {address} rejected the command")
+
+    def report(self, address, report_id):
+        if address == UART_BROADCAST:
+            raise Exception("reports can't be read from all boards at once")
+        return self.request(address, UART_TYPE_GET_REPORT, [report_id])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Control relay boards with the UART transport")
+    parser.add_argument("--port", help="Serial port, e.g. /dev/ttyUSB0", required=True)
+    parser.add_argument("--baud", type=int, default=9600, help="Baud rate (Default is %(default)s)")
+    parser.add_argument(
+        "--address",
+        type=int,
+        default=1,
+        help=f"Address of the board, or {UART_BROADCAST} for all boards without an answer (Default is %(default)s)",
+    )
+    parser.add_argument(
+        "--timeout", type=float, default=0.1, help="Seconds to wait for an answer (Default is %(default)s)"
+    )
+
+    subparsers = parser.add_subparsers(dest="action", required=True)
+    on = subparsers.add_parser("on", help="Turn a relay on")
+    on.add_argument("relay", type=int)
+    off = subparsers.add_parser("off", help="Turn a relay off")
+    off.add_argument("relay", type=int)
+    subparsers.add_parser("all-on", help="Turn all relays on")
+    subparsers.add_parser("all-off", help="Turn all relays off")
+    mask = subparsers.add_parser("set", help="Set the relays in MASK to STATE")
+    mask.add_argument("mask", type=lambda x: int(x, 0))
+    mask.add_argument("state", type=lambda x: int(x, 0))
+    subparsers.add_parser("state", help="Show the serial number and the relay state")
+    report = subparsers.add_parser("report", help="Dump a report in hex")
+    report.add_argument("id", type=int)
+    raw = subparsers.add_parser("raw", help="Send the command bytes in hex, e.g. ff01")
+    raw.add_argument("data", type=bytes.fromhex)
+
+    args = parser.parse_args()
+    bus = Bus(args.port, args.baud, args.timeout)
+
+    if args.action == "on":
+        bus.command(args.address, [CMD_ON, args.relay])
+    elif args.action == "off":
+        bus.command(args.address, [CMD_OFF, args.relay])
+    elif args.action == "all-on":
+        bus.command(args.address, [CMD_ALL_ON])
+    elif args.action == "all-off":
+        bus.command(args.address, [CMD_ALL_OFF])
+    elif args.action == "set":
+        bus.command(args.address, [CMD_SET_MASK, args.mask, args.state])
+    elif args.action == "state":
+        data = bus.report(args.address, REPORT_ID_RELAYS)
+        print(f"serial {data[:5].decode('ascii', 'replace')} relays 0x{data[7]:02x} inputs 0x{data[6]:02x}")
+    elif args.action == "report":
+        data = bus.report(args.address, args.id)
+        if not data:
+            print(f"board {args.address} has no report {args.id}", file=sys.stderr)
+            return 1
+        print(data.hex())
+    elif args.action == "raw":
+        bus.command(args.address, args.data)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,233 @@
+#! /usr/bin/env python3
+#
+# Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+#
+# SPDX-License-Identifier: GPL-2.0
+#
+# Uploads new firmware to relay boards over USB with the bootloader (see
+# include/bootloader.h). Boards running the application are asked to start
+# the bootloader, and are found again by the USB port they are plugged in to.
+# All of the boards are updated at the same time.
+#
+# Needs pyusb, and permission to access the devices.
+
+import argparse
+import concurrent.futures
+import struct
+import sys
+import time
+
+import usb.core
+import usb.util
+
+import ihex
+
+VENDOR_ID = 0x16C0
+APP_PRODUCT_ID = 0x05DF
+BOOT_PRODUCT_ID = 0x05DC
+APP_PRODUCT_PREFIX = "USBRelay"
+BOOT_PRODUCT = "HIDRelayBoot"
+
+CMD_ENTER_BOOTLOADER = 0xF2
+BOOTLOADER_MAGIC = 0xB7
+
+USB_HID_REPORT_TYPE_FEATURE = 3
+SET_REPORT = 9
+
+BOOT_RQ_INFO = 1
+BOOT_RQ_WRITE = 2
+BOOT_RQ_READ = 3
+BOOT_RQ_EXIT = 4
+
+BOOT_PROTOCOL_VERSION = 1
+BOOT_FLAG_TRAMPOLINE = 0x01
+
+# The reset and USB interrupt vectors, which the bootloader changes on the
+# ATtinies
+TRAMPOLINE_PATCHED = 4
+
+RETRIES = 3
+
+
+def port_path(dev):
+    return f"{dev.bus}-{'.'.join(str(p) for p in dev.port_numbers or [])}"
+
+
+def product(dev):
+    try:
+        return usb.util.get_string(dev, dev.iProduct) or ""
+    except (usb.core.USBError, ValueError):
+        return ""
+
+
+def serial(dev):
+    try:
+        return usb.util.get_string(dev, dev.iSerialNumber) or ""
+    except (usb.core.USBError, ValueError):
+        return ""
+
+
+def find(product_id, name, exact):
+    devices = {}
+    for dev in usb.core.find(find_all=True, idVendor=VENDOR_ID, idProduct=product_id):
+        p = product(dev)
+        if p == name or (not exact and p.startswith(name)):
+            devices[port_path(dev)] = dev
+    return devices
+
+
+def enter_bootloader(dev):
+    if dev.is_kernel_driver_active(0):
+        dev.detach_kernel_driver(0)
+    report = bytes([CMD_ENTER_BOOTLOADER, BOOTLOADER_MAGIC, 0, 0, 0, 0, 0, 0])
+    try:
+        dev.ctrl_transfer(
+            usb.util.CTRL_OUT | usb.util.CTRL_TYPE_CLASS | usb.util.CTRL_RECIPIENT_INTERFACE,
+            SET_REPORT,
+            USB_HID_REPORT_TYPE_FEATURE << 8,
+            0,
+            report,
+        )
+    except usb.core.USBError:
+        # The board may reset before the transfer completes
+        pass
+    usb.util.dispose_resources(dev)
+
+
+def wait_bootloader(path, timeout):
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        dev = find(BOOT_PRODUCT_ID, BOOT_PRODUCT, True).get(path)
+        if dev is not None:
+            return dev
+        time.sleep(0.2)
+    raise Exception("the bootloader did not appear")
+
+
+def control(dev, request, index, data_or_length):
+    direction = usb.util.CTRL_IN if isinstance(data_or_length, int) else usb.util.CTRL_OUT
+    for attempt in range(RETRIES):
+        try:
+            return dev.ctrl_transfer(
+                direction | usb.util.CTRL_TYPE_VENDOR | usb.util.CTRL_RECIPIENT_DEVICE,
+                request,
+                0,
+                index,
+                data_or_length,
+            )
+        except usb.core.USBError:
+            if attempt == RETRIES - 1:
+                raise
+            time.sleep(0.05)
+
+
+def upload(dev, image, verify):
+    version, flags, page_size, app_size, write_ms = struct.unpack(
+        "<BBHHB", bytes(control(dev, BOOT_RQ_INFO, 0, 7))
+    )
+    if version != BOOT_PROTOCOL_VERSION:
+        raise Exception(f"unsupported bootloader version {version}")
+    if len(image) > app_size:
+        raise Exception(f"the firmware is {len(image)} bytes, but only {app_size} fit")
+
+    image = image + b"\xff" * (-len(image) % page_size)
+    pages = [image[a : a + page_size] for a in range(0, len(image), page_size)]
+
+    def write(addr, data):
+        control(dev, BOOT_RQ_WRITE, addr, data)
+        time.sleep(write_ms / 1000)
+
+    # Page 0 is erased first and written last, so that the bootloader does not
+    # start a partly written application if the upload is interrupted
+    write(0, b"\xff" * page_size)
+    for i in range(1, len(pages)):
+        write(i * page_size, pages[i])
+    write(0, pages[0])
+
+    if verify:
+        for i, page in enumerate(pages):
+            data = bytes(control(dev, BOOT_RQ_READ, i * page_size, page_size))
+            skip = TRAMPOLINE_PATCHED if i == 0 and flags & BOOT_FLAG_TRAMPOLINE else 0
+            if data[skip:] != page[skip:]:
+                raise Exception(f"verify failed in the page at 0x{i * page_size:04x}")
+
+    try:
+        control(dev, BOOT_RQ_EXIT, 0, b"")
+    except usb.core.USBError:
+        pass
+    return len(image)
+
+
+def update(path, dev, image, verify, timeout):
+    if dev.idProduct == APP_PRODUCT_ID:
+        enter_bootloader(dev)
+        dev = wait_bootloader(path, timeout)
+    size = upload(dev, image, verify)
+    usb.util.dispose_resources(dev)
+    return size
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Upload firmware to relay boards over USB")
+    parser.add_argument("hex", help="Application flash image (hidrelay.hex)")
+    parser.add_argument(
+        "--serial",
+        action="append",
+        default=[],
+        help="Only update the board with this serial number. May be repeated",
+    )
+    parser.add_argument(
+        "--port",
+        action="append",
+        default=[],
+        help="Only update the board on this USB port (e.g. 1-2.3). May be repeated",
+    )
+    parser.add_argument(
+        "--jobs", "-j", type=int, default=None, help="Number of boards to update at once"
+    )
+    parser.add_argument(
+        "--timeout",
+        type=float,
+        default=5,
+        help="Seconds to wait for a board to start its bootloader (Default is %(default)s)",
+    )
+    parser.add_argument("--no-verify", action="store_true", help="Don't read back the firmware")
+    args = parser.parse_args()
+
+    image = ihex.read(args.hex)
+
+    devices = find(BOOT_PRODUCT_ID, BOOT_PRODUCT, True)
+    devices.update(find(APP_PRODUCT_ID, APP_PRODUCT_PREFIX, False))
+    if args.serial:
+        devices = {
+            p: d
+            for p, d in devices.items()
+            if d.idProduct == APP_PRODUCT_ID and serial(d) in args.serial
+        }
+    if args.port:
+        devices = {p: d for p, d in devices.items() if p in args.port}
+
+    if not devices:
+        print("No boards found", file=sys.stderr)
+        return 1
+
+    failed = 0
+    with concurrent.futures.ThreadPoolExecutor(max_workers=args.jobs) as executor:
+        futures = {
+            executor.submit(update, p, d, image, not args.no_verify, args.timeout): p
+            for p, d in devices.items()
+        }
+        for future in concurrent.futures.as_completed(futures):
+            path = futures[future]
+            try:
+                print(f"{path}: wrote {future.result()} bytes")
+            except Exception as e:
+                print(f"{path}: failed: {e}", file=sys.stderr)
+                failed += 1
+
+    print(f"{len(devices) - failed} of {len(devices)} boards updated")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Each conversion is started from the interrupt of the previous one, after
+ * the multiplexer has been switched to the next channel. This keeps the ADC
+ * running without the main loop, and unlike the auto triggered free running
+ * mode a result can never be attributed to the wrong channel when the V-USB
+ * interrupt delays the ADC interrupt. The interrupt re-enables interrupts
+ * first so that it never delays the V-USB interrupt.
+ *
+ * A completed window is handed to the main loop through the ready mask: the
+ * interrupt only writes a window while its bit is clear, and the main loop
+ * only reads it while its bit is set.
+ */
+#include "adc.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "reports.h"
+
+#if defined(MUX5)
+/* ATtiny261/461/861: MUX5 and REFS2 are in ADCSRB */
+#if ADC_REFERENCE == ADC_REF_VCC
+#define ADMUX_REFS 0
+#define ADCSRB_REFS 0
+#elif ADC_REFERENCE == ADC_REF_AREF
+#define ADMUX_REFS _BV(REFS0)
+#define ADCSRB_REFS 0
+#elif ADC_REFERENCE == ADC_REF_1V1
+#define ADMUX_REFS _BV(REFS1)
+#define ADCSRB_REFS 0
+#else
+#define ADMUX_REFS _BV(REFS1)
+#define ADCSRB_REFS _BV(REFS2)
+#endif
+
+#define SET_MUX(mux)                                                           \
+  do {                                                                         \
+    ADMUX = ADMUX_REFS | ((mux) & 0x1F);                                       \
+    ADCSRB = ADCSRB_REFS | (((mux) & 0x20) ? _BV(MUX5) : 0);                   \
+  } while (0)
+#elif defined(REFS2)
+/* ATtiny25/45/85: REFS2 is in ADMUX */
+#if ADC_REFERENCE == ADC_REF_VCC
+#define ADMUX_REFS 0
+#elif ADC_REFERENCE == ADC_REF_AREF
+#define ADMUX_REFS _BV(REFS0)
+#elif ADC_REFERENCE == ADC_REF_1V1
+#define ADMUX_REFS _BV(REFS1)
+#else
+#define ADMUX_REFS (_BV(REFS2) | _BV(REFS1))
+#endif
+
+#define SET_MUX(mux) (ADMUX = ADMUX_REFS | (mux))
+#else
+/* ATmega8 */
+#if ADC_REFERENCE == ADC_REF_VCC
+#define ADMUX_REFS _BV(REFS0)
+#elif ADC_REFERENCE == ADC_REF_AREF
+#define ADMUX_REFS 0
+#elif ADC_REFERENCE == ADC_REF_2V56
+#define ADMUX_REFS (_BV(REFS1) | _BV(REFS0))
+#else
+#error "The 1.1V reference is not available"
+#endif
+
+#define SET_MUX(mux) (ADMUX = ADMUX_REFS | (mux))
+#endif
+
+/* The ADC clock must be 200 kHz or less for full resolution */
+#if F_CPU / 64 <= 200000UL
+#define ADC_PRESCALE (_BV(ADPS2) | _BV(ADPS1))
+#else
+#define ADC_PRESCALE (_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0))
+#endif
+
+#define ADC_START (_BV(ADEN) | _BV(ADSC) | _BV(ADIE) | ADC_PRESCALE)
+
+struct accumulator {
+  uint16_t sum;
+  uint16_t min;
+  uint16_t max;
+  uint8_t count;
+};
+
+static const uint8_t channels[NUM_ADC_CHANNELS] PROGMEM = {ADC_CHANNELS};
+
+static struct accumulator accumulators[NUM_ADC_CHANNELS];
+static struct adc_result windows[NUM_ADC_CHANNELS];
+static volatile uint8_t ready;
+static uint8_t current;
+
+struct adc_report adc_report = {.report_id = REPORT_ID_ADC};
+uint8_t adc_updated;
+
+ISR(ADC_vect, ISR_NOBLOCK) {
+  struct accumulator *a = &accumulators[current];
+  uint16_t sample = ADC;
+  uint8_t bit = 1 << current;
+
+  a->sum += sample;
+  if (sample < a->min) {
+    a->min = sample;
+  }
+  if (sample > a->max) {
+    a->max = sample;
+  }
+
+  if (++a->count == ADC_WINDOW) {
+    /* If the main loop has not collected the previous window yet, this one
+     * is dropped */
+    if (!(ready & bit)) {
+      windows[current].avg = a->sum >> ADC_WINDOW_SHIFT;
+      windows[current].min = a->min;
+      windows[current].max = a->max;
+      ready |= bit;
+    }
+    a->sum = 0;
+    a->min = 0xFFFF;
+    a->max = 0;
+    a->count = 0;
+  }
+
+#if NUM_ADC_CHANNELS > 1
+  if (++current == NUM_ADC_CHANNELS) {
+    current = 0;
+  }
+  SET_MUX(pgm_read_byte(&channels[current]));
+#endif
+
+  ADCSRA = ADC_START;
+}
+
+void init_adc(void) {
+  for (uint8_t i = 0; i < NUM_ADC_CHANNELS; i++) {
+    accumulators[i].min = 0xFFFF;
+  }
+
+  SET_MUX(pgm_read_byte(&channels[0]));
+  ADCSRA = ADC_START;
+}
+
+void adc_poll(void) {
+  uint8_t pending = ready;
+
+  if (!pending) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < NUM_ADC_CHANNELS; i++) {
+    if (pending & (1 << i)) {
+      adc_report.results[i] = windows[i];
+    }
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { ready &= ~pending; }
+  adc_updated |= pending;
+}
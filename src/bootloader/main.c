@@ -0,0 +1,355 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * USB bootloader. It starts the application straight away, before touching
+ * any hardware, unless the application asked for it or the reset pin was
+ * used. Otherwise it waits for the host to write the new application a page
+ * at a time (see include/bootloader.h), and starts it with a watchdog reset
+ * when told to, or after BOOTLOADER_TIMEOUT_S without a request.
+ */
+#include <avr/boot.h>
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+#include <stdbool.h>
+#include <string.h>
+#include <util/delay.h>
+
+#include "bootloader.h"
+#include "usbdrv.h"
+
+#ifdef MCUSR
+#define RESET_CAUSE MCUSR
+#else
+#define RESET_CAUSE MCUCSR
+#endif
+
+#ifdef TCCR0B
+#define TIMER_CONTROL TCCR0B
+#else
+#define TIMER_CONTROL TCCR0
+#endif
+
+/* Timer 0 overflows in BOOTLOADER_TIMEOUT_S with the /1024 prescaler */
+#define TIMEOUT_OVERFLOWS (BOOTLOADER_TIMEOUT_S * F_CPU / 1024UL / 256UL)
+
+#define WRITE_MS 20
+
+/* The instruction at word address from that jumps to word address to. The
+ * supported parts have at most 8 KB of flash, so rjmp reaches all of it */
+#define RJMP(from, to) (0xC000 | (((to) - (from)-1) & 0x0FFF))
+
+#if BOOTLOADER_TRAMPOLINE
+/*
+ * Word address of the trampoline, which is:
+ *   rjmp <application reset>
+ *   sbic GPIOR0, 0
+ *   rjmp <bootloader USB interrupt>
+ *   rjmp <application USB interrupt>
+ * The application must leave bit 0 of GPIOR0 clear
+ */
+#define TRAMPOLINE (BOOTLOADER_APP_END / 2)
+#define SBIC_ACTIVE (0x9900 | (_SFR_IO_ADDR(GPIOR0) << 3))
+#define BOOT_ACTIVE _BV(0)
+
+/* The bootloader copy of the V-USB interrupt handler (INT0) */
+extern void __vector_1(void);
+
+/*
+ * Reset and USB interrupt vectors for a board that has only the bootloader,
+ * placed at address 0 by the linker. They jump to the same vectors of the
+ * bootloader, whose vector table is at the start of its .text (one rjmp per
+ * vector on these parts). The application replaces them when it is written
+ */
+__attribute__((used,
+               section(".reset"))) static uint16_t const reset_vectors[2] = {
+    RJMP(0, BOOTLOADER_ADDR / 2),
+    RJMP(1, BOOTLOADER_ADDR / 2 + 1),
+};
+#endif
+
+static struct boot_info info = {
+    .version = BOOT_PROTOCOL_VERSION,
+#if BOOTLOADER_TRAMPOLINE
+    .flags = BOOT_FLAG_TRAMPOLINE,
+#endif
+    .page_size = SPM_PAGESIZE,
+    .app_size = BOOTLOADER_APP_END,
+    .write_ms = WRITE_MS,
+};
+
+static uint8_t requested __attribute__((section(".noinit")));
+
+static uint16_t page[SPM_PAGESIZE / 2];
+static uint16_t page_addr;
+static uint8_t page_fill;
+static volatile bool page_ready;
+static uint16_t read_addr;
+static bool write_rejected;
+static bool exiting;
+static uint16_t idle;
+
+/*
+ * Runs from .init3, after the stack pointer has been set up in .init2 and
+ * before anything has been pushed on the stack, so the request from the
+ * application is still there
+ */
+void check_request(void) __attribute__((naked, used, section(".init3")));
+void check_request(void) {
+  uint8_t magic = BOOTLOADER_REQUEST;
+
+  BOOTLOADER_REQUEST = 0;
+  requested = magic == BOOTLOADER_MAGIC;
+}
+
+static bool app_present(void) {
+#if BOOTLOADER_TRAMPOLINE
+  return pgm_read_word(TRAMPOLINE * 2) != 0xFFFF;
+#else
+  return pgm_read_word(0) != 0xFFFF;
+#endif
+}
+
+static void start_app(void) {
+#if BOOTLOADER_TRAMPOLINE
+  ((void (*)(void))TRAMPOLINE)();
+#else
+  ((void (*)(void))0)();
+#endif
+}
+
+/*
+ * Erases the page at addr, and writes count words to it. Interrupts are
+ * enabled between the steps so that USB keeps working, except for the pages
+ * with the vectors and the trampoline on the ATtinies: the USB interrupt goes
+ * through them, so it must not run until they have been written again. An
+ * edge on D+ in the meantime is dropped, and the host retries the packet
+ */
+static void program(uint16_t addr, uint16_t const *words, uint8_t count) {
+#if BOOTLOADER_TRAMPOLINE
+  bool live = addr == 0 || addr == TRAMPOLINE * 2;
+#else
+  bool const live = false;
+#endif
+
+  cli();
+  boot_page_erase(addr);
+  if (!live) {
+    sei();
+  }
+  boot_spm_busy_wait();
+
+  for (uint8_t i = 0; i < count; i++) {
+    cli();
+    boot_page_fill(addr + i * 2, words[i]);
+    if (!live) {
+      sei();
+    }
+  }
+
+  cli();
+  boot_page_write(addr);
+  if (!live) {
+    sei();
+  }
+  boot_spm_busy_wait();
+
+#ifdef RWWSRE
+  cli();
+  boot_rww_enable();
+#endif
+  if (live) {
+    GIFR = _BV(INTF0);
+  }
+  sei();
+}
+
+#if BOOTLOADER_TRAMPOLINE
+/* Moves the rjmp at word address from to word address to */
+static uint16_t retarget(uint16_t insn, uint16_t from, uint16_t to) {
+  if ((insn & 0xF000) != 0xC000) {
+    return insn;
+  }
+  return RJMP(to, from + 1 + insn);
+}
+
+/* Points the reset and USB interrupt vectors of page 0 at the bootloader, and
+ * writes the trampoline to the vectors of the application */
+static void patch_vectors(void) {
+  uint16_t trampoline[4] = {
+      retarget(page[0], 0, TRAMPOLINE),
+      SBIC_ACTIVE,
+      RJMP(TRAMPOLINE + 2, (uint16_t)(uintptr_t)__vector_1),
+      retarget(page[1], 1, TRAMPOLINE + 3),
+  };
+
+  program(TRAMPOLINE * 2, trampoline, 4);
+  page[0] = RJMP(0, BOOTLOADER_ADDR / 2);
+  page[1] = RJMP(1, TRAMPOLINE + 1);
+}
+#endif
+
+/* Lets the status stage of the last transfer complete before the flash is
+ * written or the device resets */
+static void settle(void) {
+  for (uint8_t i = 0; i < 20; i++) {
+    usbPoll();
+    _delay_us(100);
+  }
+}
+
+#if CALIBRATE_OSCILLATOR
+/*
+ * Binary search of each half of the OSCCAL range, which overlap on the
+ * ATtinies, keeping the closest. Keep alive frames are sent every
+ * millisecond, and usbMeasureFrameLength() counts in units of 6 cycles
+ */
+void usbEventResetReady(void) {
+  uint16_t const target = (USB_CFG_CLOCK_KHZ + 3) / 6;
+  uint16_t best_dev = 0xFFFF;
+  uint8_t best = OSCCAL;
+
+  cli();
+  for (uint8_t range = 0; range < 2; range++) {
+    uint8_t value = range ? 0x80 : 0;
+
+    for (uint8_t step = 0x40; step > 0; step >>= 1) {
+      OSCCAL = value + step;
+      if (usbMeasureFrameLength() < target) {
+        value += step;
+      }
+    }
+
+    OSCCAL = value;
+    uint16_t x = usbMeasureFrameLength();
+    uint16_t dev = x < target ? target - x : x - target;
+    if (dev < best_dev) {
+      best_dev = dev;
+      best = value;
+    }
+  }
+  OSCCAL = best;
+  sei();
+}
+#endif
+
+usbMsgLen_t usbFunctionSetup(uchar data[8]) {
+  usbRequest_t *rq = (void *)data;
+
+  if ((rq->bmRequestType & USBRQ_TYPE_MASK) != USBRQ_TYPE_VENDOR) {
+    return 0;
+  }
+
+  idle = 0;
+  switch (rq->bRequest) {
+  case BOOT_RQ_INFO:
+    usbMsgPtr = (uchar *)&info;
+    return sizeof(info);
+
+  case BOOT_RQ_WRITE:
+    /* A rejected write still takes the data, so that usbFunctionWrite() can
+     * stall it and the host sees the failure */
+    write_rejected = page_ready || rq->wIndex.word % SPM_PAGESIZE ||
+                     rq->wIndex.word >= BOOTLOADER_APP_END ||
+                     rq->wLength.word != SPM_PAGESIZE;
+    if (!write_rejected) {
+      page_addr = rq->wIndex.word;
+      page_fill = 0;
+    }
+    return USB_NO_MSG;
+
+  case BOOT_RQ_READ:
+    read_addr = rq->wIndex.word;
+    return USB_NO_MSG;
+
+  case BOOT_RQ_EXIT:
+    exiting = true;
+    return 0;
+  }
+  return 0;
+}
+
+uchar usbFunctionWrite(uchar *data, uchar len) {
+  if (write_rejected) {
+    return 0xFF;
+  }
+  if (len > SPM_PAGESIZE - page_fill) {
+    len = SPM_PAGESIZE - page_fill;
+  }
+  memcpy((uint8_t *)page + page_fill, data, len);
+  page_fill += len;
+
+  if (page_fill < SPM_PAGESIZE) {
+    return 0;
+  }
+  page_ready = true;
+  return 1;
+}
+
+uchar usbFunctionRead(uchar *data, uchar len) {
+  for (uint8_t i = 0; i < len; i++) {
+    data[i] = read_addr < BOOTLOADER_APP_END ? pgm_read_byte(read_addr) : 0xFF;
+    read_addr++;
+  }
+  return len;
+}
+
+int main(void) {
+  if (!requested && !(RESET_CAUSE & _BV(EXTRF)) && app_present()) {
+    start_app();
+  }
+
+  RESET_CAUSE = 0;
+  wdt_disable();
+
+#if BOOTLOADER_TRAMPOLINE
+  GPIOR0 |= BOOT_ACTIVE;
+#else
+  /* Move the interrupt vectors to the boot section */
+  GICR = _BV(IVCE);
+  GICR = _BV(IVSEL);
+#endif
+
+  TIMER_CONTROL = _BV(CS02) | _BV(CS00);
+
+  usbInit();
+  usbDeviceDisconnect();
+  for (uint8_t i = 0; i < 250; i++) {
+    _delay_ms(1);
+  }
+  usbDeviceConnect();
+  sei();
+
+  while (true) {
+    usbPoll();
+
+    if (page_ready) {
+      settle();
+#if BOOTLOADER_TRAMPOLINE
+      if (page_addr == 0) {
+        patch_vectors();
+      }
+#endif
+      program(page_addr, page, SPM_PAGESIZE / 2);
+      page_ready = false;
+      idle = 0;
+    }
+
+    if (TIFR & _BV(TOV0)) {
+      TIFR = _BV(TOV0);
+      if (app_present() && ++idle >= TIMEOUT_OVERFLOWS) {
+        exiting = true;
+      }
+    }
+
+    if (exiting) {
+      settle();
+      wdt_enable(WDTO_15MS);
+      while (true) {
+      }
+    }
+  }
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * V-USB configuration of the bootloader. The options are documented in
+ * usbdrv/usbconfig-prototype.h. The USB pins and clock are the same as the
+ * application (they come from the cross file), but the bootloader is a
+ * vendor class device with only the control endpoint, which keeps it small
+ * and lets the host talk to it with libusb without a kernel driver.
+ */
+#ifndef __usbconfig_h_included__
+#define __usbconfig_h_included__
+
+/* ---------------------------- Hardware Config ---------------------------- */
+
+#define USB_CFG_CLOCK_KHZ       (F_CPU/1000)
+#define USB_CFG_CHECK_CRC       0
+
+/* --------------------------- Functional Range ---------------------------- */
+
+#define USB_CFG_HAVE_INTRIN_ENDPOINT    0
+#define USB_CFG_HAVE_INTRIN_ENDPOINT3   0
+#define USB_CFG_IMPLEMENT_HALT          0
+#define USB_CFG_SUPPRESS_INTR_CODE      1
+#define USB_CFG_INTR_POLL_INTERVAL      10
+#define USB_CFG_IS_SELF_POWERED         0
+#define USB_CFG_MAX_BUS_POWER           100
+#define USB_CFG_IMPLEMENT_FN_WRITE      1
+#define USB_CFG_IMPLEMENT_FN_READ       1
+#define USB_CFG_IMPLEMENT_FN_WRITEOUT   0
+#define USB_CFG_HAVE_FLOWCONTROL        0
+#define USB_CFG_DRIVER_FLASH_PAGE       0
+#define USB_CFG_LONG_TRANSFERS          0
+#define USB_COUNT_SOF                   0
+#define USB_CFG_CHECK_DATA_TOGGLING     0
+
+#if CALIBRATE_OSCILLATOR
+#ifndef __ASSEMBLER__
+void usbEventResetReady(void);
+#endif
+#define USB_RESET_HOOK(isReset)             if(!isReset){usbEventResetReady();}
+#define USB_CFG_HAVE_MEASURE_FRAME_LENGTH   1
+#else
+#define USB_CFG_HAVE_MEASURE_FRAME_LENGTH   0
+#endif
+
+/* -------------------------- Device Description --------------------------- */
+
+/* obdev's shared VID/PID pair for vendor class devices with libusb. Devices
+ * using it are told apart by the vendor and product names */
+#define USB_CFG_VENDOR_ID       0xc0, 0x16 /* = 0x16c0 = 5824 = voti.nl */
+#define USB_CFG_DEVICE_ID       0xdc, 0x05 /* = 0x05dc = 1500 */
+#define USB_CFG_DEVICE_VERSION  0x00, 0x01
+#define USB_CFG_VENDOR_NAME     'w', 'w', 'w', '.', 'd', 'c', 't', 't', 'e', 'c', 'h', '.', 'c', 'o', 'm'
+#define USB_CFG_VENDOR_NAME_LEN 15
+#define USB_CFG_DEVICE_NAME     'H', 'I', 'D', 'R', 'e', 'l', 'a', 'y', 'B', 'o', 'o', 't'
+#define USB_CFG_DEVICE_NAME_LEN 12
+#define USB_CFG_DEVICE_CLASS        0xff
+#define USB_CFG_DEVICE_SUBCLASS     0
+#define USB_CFG_INTERFACE_CLASS     0
+#define USB_CFG_INTERFACE_SUBCLASS  0
+#define USB_CFG_INTERFACE_PROTOCOL  0
+
+#define USB_CFG_DESCR_PROPS_DEVICE                  0
+#define USB_CFG_DESCR_PROPS_CONFIGURATION           0
+#define USB_CFG_DESCR_PROPS_STRINGS                 0
+#define USB_CFG_DESCR_PROPS_STRING_0                0
+#define USB_CFG_DESCR_PROPS_STRING_VENDOR           0
+#define USB_CFG_DESCR_PROPS_STRING_PRODUCT          0
+#define USB_CFG_DESCR_PROPS_STRING_SERIAL_NUMBER    0
+#define USB_CFG_DESCR_PROPS_HID                     0
+#define USB_CFG_DESCR_PROPS_HID_REPORT              0
+#define USB_CFG_DESCR_PROPS_UNKNOWN                 0
+
+#endif /* __usbconfig_h_included__ */
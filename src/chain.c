@@ -0,0 +1,168 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "chain.h"
+
+#include <string.h>
+
+#include "command.h"
+#include "reports.h"
+#include "timer.h"
+#include "uart.h"
+
+#define QUEUE_LEN 4
+#define TRIES 3
+
+/* Long enough for the longest request and answer to be sent at the baud
+ * rate, and for the board to write a few bytes of EEPROM in between */
+#define TIMEOUT_MS (30UL + 30UL * 10UL * 1000UL / UART_BAUD)
+#define TIMEOUT_TICKS TIMER_DELAY_TICKS(TIMEOUT_MS)
+
+/* Time after a broadcast has been sent for every board to handle it */
+#define BROADCAST_TICKS TIMER_DELAY_TICKS(5)
+
+struct forward {
+  uint8_t board;
+  uint8_t len;
+  uint8_t data[CHAIN_MAX_COMMAND];
+};
+
+enum chain_state {
+  CHAIN_IDLE,
+  CHAIN_WAITING,
+  CHAIN_BROADCAST,
+};
+
+struct chain_report chain_report = {.report_id = REPORT_ID_CHAIN};
+
+static struct forward queue[QUEUE_LEN];
+static uint8_t queue_head;
+static uint8_t queue_count;
+
+static enum chain_state state;
+/* The current request is a read of the relay state instead of a command */
+static bool polling;
+static uint8_t target;
+static uint8_t tries;
+static uint16_t wait;
+static uint8_t next_poll = 1;
+
+static uint8_t const relays_report_id = REPORT_ID_RELAYS;
+
+bool chain_forward(uint8_t board, uint8_t const *data, uint8_t len) {
+  struct forward *f;
+
+  if (board > CHAIN_BOARDS || len > CHAIN_MAX_COMMAND) {
+    return false;
+  }
+  if (queue_count == QUEUE_LEN) {
+    chain_report.dropped++;
+    return false;
+  }
+
+  f = &queue[(queue_head + queue_count) % QUEUE_LEN];
+  f->board = board;
+  f->len = len;
+  memcpy(f->data, data, len);
+  queue_count++;
+  return true;
+}
+
+static void send_request(void) {
+  if (polling) {
+    uart_send(target, UART_TYPE_GET_REPORT, &relays_report_id, 1);
+  } else {
+    struct forward const *f = &queue[queue_head];
+
+    uart_send(target, UART_TYPE_COMMAND, f->data, f->len);
+  }
+  tries++;
+  wait = target == UART_BROADCAST ? BROADCAST_TICKS : TIMEOUT_TICKS;
+}
+
+static void finish(void) {
+  if (polling) {
+    next_poll = next_poll % CHAIN_BOARDS + 1;
+  } else {
+    queue_head = (queue_head + 1) % QUEUE_LEN;
+    queue_count--;
+  }
+  state = CHAIN_IDLE;
+}
+
+static void set_online(uint8_t board, bool online) {
+  uint32_t bit = 1UL << (board - 1);
+
+  if (online) {
+    chain_report.online |= bit;
+  } else {
+    chain_report.online &= ~bit;
+  }
+}
+
+void chain_answer(uint8_t address, uint8_t type, uint8_t const *data,
+                  uint8_t len) {
+  if (state != CHAIN_WAITING || address != target ||
+      type != (polling ? UART_TYPE_GET_REPORT : UART_TYPE_COMMAND)) {
+    return;
+  }
+
+  set_online(address, true);
+  if (polling) {
+    if (len >= RELAYS_REPORT_LEN) {
+      chain_report.state[address] = data[RELAYS_REPORT_LEN - 1];
+    }
+  } else {
+    if (len < 1 || data[0] != COMMAND_OK) {
+      chain_report.rejected++;
+    }
+    /* Read the new state of the board next */
+    next_poll = address;
+  }
+  finish();
+}
+
+void chain_poll(uint8_t elapsed) {
+  switch (state) {
+  case CHAIN_IDLE:
+    if (uart_busy()) {
+      return;
+    }
+    polling = queue_count == 0;
+    target = polling ? next_poll : queue[queue_head].board;
+    tries = 0;
+    send_request();
+    state = target == UART_BROADCAST ? CHAIN_BROADCAST : CHAIN_WAITING;
+    break;
+
+  case CHAIN_WAITING:
+    if (elapsed < wait) {
+      wait -= elapsed;
+      return;
+    }
+    if (uart_busy()) {
+      return;
+    }
+    if (tries < TRIES) {
+      send_request();
+      return;
+    }
+    set_online(target, false);
+    chain_report.timeouts++;
+    finish();
+    break;
+
+  case CHAIN_BROADCAST:
+    if (uart_busy()) {
+      return;
+    }
+    if (elapsed < wait) {
+      wait -= elapsed;
+      return;
+    }
+    finish();
+    break;
+  }
+}
@@ -0,0 +1,348 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "command.h"
+
+#include <avr/eeprom.h>
+#include <string.h>
+
+#if NUM_ADC_CHANNELS
+#include "adc.h"
+#endif
+#if BOOTLOADER
+#include "bootloader.h"
+#endif
+#if CHAIN_BOARDS
+#include "chain.h"
+#endif
+#if NUM_COUNTERS
+#include "counters.h"
+#endif
+#include "feedback.h"
+#include "inputs.h"
+#if NUM_MACROS
+#include "macros.h"
+#endif
+#include "main.h"
+#include "relays.h"
+#include "reports.h"
+#if NUM_RULES
+#include "rules.h"
+#endif
+#if STACK_MONITOR
+#include "stack.h"
+#endif
+#if TRACE_ENTRIES
+#include "trace.h"
+#endif
+#if CHAIN_BOARDS
+#include "uart.h"
+#endif
+#include "wear.h"
+
+uint8_t EEMEM serial[] = {'J', 'P', 'E', 'W', '0'};
+_Static_assert(sizeof(serial) == SERIAL_LEN, "Invalid serial number length");
+
+#if RELAY_POWER_ON
+/* The power on state of the relays, followed by its complement so that an
+ * erased EEPROM (all 0xFF) does not turn every relay on */
+uint8_t EEMEM power_on_state[2] = {0x00, 0xFF};
+
+static void set_power_on_state(uint8_t state) {
+  eeprom_update_byte(&power_on_state[0], state);
+  eeprom_update_byte(&power_on_state[1], ~state);
+}
+#endif
+
+#if BOOTLOADER
+bool bootloader_requested;
+#endif
+
+void init_commands(void) {
+#if RELAY_POWER_ON
+  uint8_t state = eeprom_read_byte(&power_on_state[0]);
+  uint8_t check = eeprom_read_byte(&power_on_state[1]);
+
+  if ((uint8_t)(state ^ check) == 0xFF) {
+    relays_request(RELAY_ALL_MASK, state);
+    relays_settle();
+  }
+#endif
+}
+
+void get_serial(uint8_t *data) { eeprom_read_block(data, serial, SERIAL_LEN); }
+
+void set_serial(uint8_t const *data) {
+  eeprom_update_block(data, serial, SERIAL_LEN);
+#if REPORT_SERIAL
+  set_ram_serial(data);
+#endif
+}
+
+uint8_t command_handle(uint8_t const *data, uint8_t len) {
+  if (len < 1) {
+    return COMMAND_REJECTED;
+  }
+
+#if TRACE_ENTRIES
+  trace_add(data[0], len > 1 ? data[1] : 0, len > 2 ? data[2] : 0);
+#endif
+
+  switch (data[0]) {
+  case CMD_SET_SERIAL:
+    if (len < 8) {
+      return COMMAND_REJECTED;
+    }
+
+    set_serial(&data[1]);
+    return COMMAND_OK;
+
+  case CMD_ALL_OFF:
+  case CMD_ALL_ON:
+    request_all_relays(data[0] == CMD_ALL_ON);
+#if CHAIN_BOARDS
+    /* The local relays have switched, so the command succeeded even if the
+     * queue is full. The chain report counts the drop */
+    chain_forward(UART_BROADCAST, data, 1);
+#endif
+    return COMMAND_OK;
+
+  case CMD_SET_MASK:
+    if (len < 3) {
+      return COMMAND_REJECTED;
+    }
+
+    relays_request(data[1] & RELAY_ALL_MASK, data[2]);
+    return COMMAND_OK;
+
+#if RELAY_PWM_MODE_MASK
+  case CMD_SET_PWM:
+    if (len < 3) {
+      return COMMAND_REJECTED;
+    }
+
+    if (data[1] >= 1 && data[1] <= NUM_RELAYS &&
+        (RELAY_PWM_MODE_MASK & (1 << (data[1] - 1)))) {
+      relays_set_duty(data[1] - 1, data[2]);
+    }
+    return COMMAND_OK;
+#endif
+
+#if NUM_COUNTERS
+  case CMD_RESET_COUNTERS:
+    if (len < 2) {
+      return COMMAND_REJECTED;
+    }
+
+    counters_reset(data[1]);
+    return COMMAND_OK;
+#endif
+
+#if NUM_RULES
+  case CMD_SET_RULE:
+    if (len < 2 + sizeof(struct rule)) {
+      return COMMAND_REJECTED;
+    }
+
+    if (data[1] < NUM_RULES) {
+      struct rule rule;
+
+      memcpy(&rule, &data[2], sizeof(rule));
+      rules_set(data[1], &rule);
+    }
+    return COMMAND_OK;
+#endif
+
+#if NUM_MACROS
+  case CMD_SET_MACRO:
+    if (len < 2 + sizeof(struct relay_macro)) {
+      return COMMAND_REJECTED;
+    }
+
+    if (data[1] < NUM_MACROS) {
+      struct relay_macro m;
+
+      memcpy(&m, &data[2], sizeof(m));
+      macros_set(data[1], &m);
+    }
+    return COMMAND_OK;
+
+  case CMD_RUN_MACRO:
+    if (len < 2) {
+      return COMMAND_REJECTED;
+    }
+
+    macros_run(data[1]);
+    return COMMAND_OK;
+#endif
+
+#if RELAY_POWER_ON
+  case CMD_SET_POWER_ON:
+    if (len < 2) {
+      return COMMAND_REJECTED;
+    }
+
+    set_power_on_state(data[1] & RELAY_ALL_MASK);
+    return COMMAND_OK;
+#endif
+
+#if BOOTLOADER
+  case CMD_ENTER_BOOTLOADER:
+    /* The magic byte keeps a stray command from stopping the relays */
+    if (len < 2 || data[1] != BOOTLOADER_MAGIC) {
+      return COMMAND_REJECTED;
+    }
+
+    bootloader_requested = true;
+    return COMMAND_OK;
+#endif
+
+#if NUM_RELAYS > 8
+  case CMD_SET_BANK:
+    if (len < 4 || data[1] >= RELAY_BANKS) {
+      return COMMAND_REJECTED;
+    }
+
+    write_relay_bank(data[1], data[2], data[3]);
+    return COMMAND_OK;
+#endif
+
+#if CHAIN_BOARDS
+  case CMD_FORWARD:
+    if (len < 3 || data[1] > CHAIN_BOARDS) {
+      return COMMAND_REJECTED;
+    }
+
+    return chain_forward(data[1], &data[2], len - 2) ? COMMAND_OK
+                                                     : COMMAND_REJECTED;
+#endif
+
+  case CMD_ON:
+  case CMD_OFF:
+    if (len < 2) {
+      return COMMAND_REJECTED;
+    }
+
+    if (data[1] >= 1 && data[1] <= NUM_RELAYS) {
+      request_relay(data[1] - 1, data[0] == CMD_ON);
+    }
+#if CHAIN_BOARDS
+    else {
+      uint8_t board = (data[1] - 1) / CHAIN_RELAYS_PER_BOARD;
+      uint8_t cmd[2] = {data[0], (data[1] - 1) % CHAIN_RELAYS_PER_BOARD + 1};
+
+      /* Relay numbers below 9 that are not on the USB board, or past the
+       * last board, do not exist */
+      if (data[1] <= CHAIN_RELAYS_PER_BOARD || board > CHAIN_BOARDS ||
+          !chain_forward(board, cmd, sizeof(cmd))) {
+        return COMMAND_REJECTED;
+      }
+    }
+#endif
+    return COMMAND_OK;
+  }
+
+  // Unknown command
+  return COMMAND_REJECTED;
+}
+
+uint8_t command_report(uint8_t id, uint8_t const **data) {
+  static uint8_t relays_report[RELAYS_REPORT_LEN];
+#if NUM_RELAYS > 8
+  static uint8_t banks_report[2 + RELAY_BANKS] = {REPORT_ID_RELAY_BANKS,
+                                                  NUM_RELAYS};
+#endif
+
+  switch (id) {
+  case REPORT_ID_RELAYS:
+    get_serial(relays_report);
+#if RELAY_FEEDBACK_MASK
+    relays_report[5] = feedback_stats.mismatch;
+#else
+    relays_report[5] = 0;
+#endif
+#if NUM_INPUTS
+    relays_report[6] = get_input_state();
+#else
+    relays_report[6] = 0;
+#endif
+    relays_report[7] = get_relay_state();
+
+    *data = relays_report;
+    return sizeof(relays_report);
+
+#if RELAY_SCHEDULER
+  case REPORT_ID_RELAY_STATS:
+    *data = (uint8_t const *)&relay_stats;
+    return sizeof(relay_stats);
+#endif
+
+#if RELAY_FEEDBACK_MASK
+  case REPORT_ID_FEEDBACK:
+    *data = (uint8_t const *)&feedback_stats;
+    return sizeof(feedback_stats);
+#endif
+
+#if NUM_COUNTERS
+  case REPORT_ID_COUNTERS:
+    *data = (uint8_t const *)counters_snapshot();
+    return sizeof(struct counters_report);
+#endif
+
+#if NUM_ADC_CHANNELS
+  case REPORT_ID_ADC:
+    *data = (uint8_t const *)&adc_report;
+    return sizeof(adc_report);
+#endif
+
+#if NUM_RULES
+  case REPORT_ID_RULES:
+    *data = (uint8_t const *)&rules_report;
+    return sizeof(rules_report);
+#endif
+
+#if NUM_MACROS
+  case REPORT_ID_MACROS:
+    *data = (uint8_t const *)&macros_report;
+    return sizeof(macros_report);
+#endif
+
+#if RELAY_WEAR_COUNTERS
+  case REPORT_ID_WEAR:
+    *data = (uint8_t const *)&wear_report;
+    return sizeof(wear_report);
+#endif
+
+#if TRACE_ENTRIES
+  case REPORT_ID_TRACE:
+    *data = (uint8_t const *)&trace_report;
+    return sizeof(trace_report);
+#endif
+
+#if STACK_MONITOR
+  case REPORT_ID_STACK:
+    *data = (uint8_t const *)stack_snapshot();
+    return sizeof(struct stack_report);
+#endif
+
+#if CHAIN_BOARDS
+  case REPORT_ID_CHAIN:
+    chain_report.state[0] = get_relay_state();
+    *data = (uint8_t const *)&chain_report;
+    return sizeof(chain_report);
+#endif
+
+#if NUM_RELAYS > 8
+  case REPORT_ID_RELAY_BANKS:
+    for (uint8_t i = 0; i < RELAY_BANKS; i++) {
+      banks_report[2 + i] = get_relay_bank_state(i);
+    }
+    *data = banks_report;
+    return sizeof(banks_report);
+#endif
+  }
+
+  return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * The pin change interrupt must never delay the V-USB interrupt, so it
+ * re-enables interrupts first, and masks itself while it runs so that it
+ * can't nest. Edges that arrive in the meantime are latched by the pin change
+ * flag and handled right after. The main loop also masks the pin change
+ * interrupt instead of all interrupts when it reads the counters.
+ */
+#include "counters.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include "reports.h"
+
+#define _concat(a, b) a##b
+#define concat(a, b) _concat(a, b)
+
+#define COUNTER_DDR concat(DDR, COUNTER_IOPORT_NAME)
+#define COUNTER_PORT concat(PORT, COUNTER_IOPORT_NAME)
+#define COUNTER_PIN concat(PIN, COUNTER_IOPORT_NAME)
+
+#if defined(PCMSK1)
+/* ATtiny261/461/861: PCINT0-7 are port A and PCINT8-15 are port B. PCIE0
+ * enables PCINT8-11 and PCIE1 enables all the others */
+#define COUNTER_vect PCINT_vect
+#if COUNTER_PORT_A
+#define COUNTER_PCMSK PCMSK0
+#define COUNTER_PCIE _BV(PCIE1)
+#else
+#define COUNTER_PCMSK PCMSK1
+#define COUNTER_PCIE                                                           \
+  (((COUNTER_MASK & 0x0F) ? _BV(PCIE0) : 0) |                                  \
+   ((COUNTER_MASK & 0xF0) ? _BV(PCIE1) : 0))
+#endif
+#else
+/* ATtiny25/45/85 */
+#define COUNTER_vect PCINT0_vect
+#define COUNTER_PCMSK PCMSK
+#define COUNTER_PCIE _BV(PCIE)
+#endif
+
+#define counter_int_disable() (GIMSK &= ~COUNTER_PCIE)
+#define counter_int_enable() (GIMSK |= COUNTER_PCIE)
+
+static const uint8_t counter_bits[NUM_COUNTERS] = {COUNTER_BITS};
+
+static volatile uint32_t counts[NUM_COUNTERS];
+static uint8_t last_pins;
+
+static struct counters_report report = {.report_id = REPORT_ID_COUNTERS};
+
+ISR(COUNTER_vect, ISR_NOBLOCK) {
+  uint8_t pins;
+  uint8_t edges;
+
+  counter_int_disable();
+
+  pins = COUNTER_PIN;
+  edges = pins ^ last_pins;
+  last_pins = pins;
+#if COUNTER_EDGE_RISING && !COUNTER_EDGE_FALLING
+  edges &= pins;
+#elif COUNTER_EDGE_FALLING && !COUNTER_EDGE_RISING
+  edges &= ~pins;
+#endif
+
+  for (uint8_t i = 0; i < NUM_COUNTERS; i++) {
+    if (edges & counter_bits[i]) {
+      counts[i]++;
+    }
+  }
+
+  counter_int_enable();
+}
+
+void init_counters(void) {
+  COUNTER_DDR &= ~COUNTER_MASK;
+  COUNTER_PORT |= COUNTER_PULLUPS;
+
+#if defined(PCMSK1)
+  /* Only the counter inputs may raise the interrupt */
+  PCMSK0 = 0;
+  PCMSK1 = 0;
+#endif
+  COUNTER_PCMSK = COUNTER_MASK;
+
+  last_pins = COUNTER_PIN;
+  counter_int_enable();
+}
+
+struct counters_report *counters_snapshot(void) {
+  counter_int_disable();
+  for (uint8_t i = 0; i < NUM_COUNTERS; i++) {
+    report.counts[i] = counts[i];
+  }
+  counter_int_enable();
+
+  return &report;
+}
+
+void counters_reset(uint8_t mask) {
+  counter_int_disable();
+  for (uint8_t i = 0; i < NUM_COUNTERS; i++) {
+    if (mask & (1 << i)) {
+      counts[i] = 0;
+    }
+  }
+  counter_int_enable();
+}
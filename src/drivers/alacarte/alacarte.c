@@ -14,6 +14,10 @@
 
 #include "main.h"
 
+#if USE_PWM
+#include "pwm.h"
+#endif
+
 #define _concat(a, b) a##b
 #define concat(a, b) _concat(a, b)
 
@@ -40,6 +44,15 @@
     }                                                                          \
   }
 
+#define WRITE_RELAY(n)                                                         \
+  if (mask & (1 << (n - 1))) {                                                 \
+    if (state & (1 << (n - 1))) {                                              \
+      RELAY_PORT(n) |= RELAY_MASK(n);                                          \
+    } else {                                                                   \
+      RELAY_PORT(n) &= ~RELAY_MASK(n);                                         \
+    }                                                                          \
+  }
+
 #define GET_RELAY(n)                                                           \
   if (RELAY_PORT(n) & RELAY_MASK(n)) {                                         \
     state |= (1 << (n - 1));                                                   \
@@ -48,75 +61,90 @@
 #define INIT_RELAY_1() INIT_RELAY(1)
 #define GET_RELAY_1() GET_RELAY(1)
 #define SET_RELAY_1() SET_RELAY(1)
+#define WRITE_RELAY_1() WRITE_RELAY(1)
 
 #if NUM_RELAYS >= 2
 #define INIT_RELAY_2() INIT_RELAY(2)
 #define GET_RELAY_2() GET_RELAY(2)
 #define SET_RELAY_2() SET_RELAY(2)
+#define WRITE_RELAY_2() WRITE_RELAY(2)
 #else
 #define INIT_RELAY_2()
 #define GET_RELAY_2()
 #define SET_RELAY_2()
+#define WRITE_RELAY_2()
 #endif
 
 #if NUM_RELAYS >= 3
 #define INIT_RELAY_3() INIT_RELAY(3)
 #define GET_RELAY_3() GET_RELAY(3)
 #define SET_RELAY_3() SET_RELAY(3)
+#define WRITE_RELAY_3() WRITE_RELAY(3)
 #else
 #define INIT_RELAY_3()
 #define GET_RELAY_3()
 #define SET_RELAY_3()
+#define WRITE_RELAY_3()
 #endif
 
 #if NUM_RELAYS >= 4
 #define INIT_RELAY_4() INIT_RELAY(4)
 #define GET_RELAY_4() GET_RELAY(4)
 #define SET_RELAY_4() SET_RELAY(4)
+#define WRITE_RELAY_4() WRITE_RELAY(4)
 #else
 #define INIT_RELAY_4()
 #define GET_RELAY_4()
 #define SET_RELAY_4()
+#define WRITE_RELAY_4()
 #endif
 
 #if NUM_RELAYS >= 5
 #define INIT_RELAY_5() INIT_RELAY(5)
 #define GET_RELAY_5() GET_RELAY(5)
 #define SET_RELAY_5() SET_RELAY(5)
+#define WRITE_RELAY_5() WRITE_RELAY(5)
 #else
 #define INIT_RELAY_5()
 #define GET_RELAY_5()
 #define SET_RELAY_5()
+#define WRITE_RELAY_5()
 #endif
 
 #if NUM_RELAYS >= 6
 #define INIT_RELAY_6() INIT_RELAY(6)
 #define GET_RELAY_6() GET_RELAY(6)
 #define SET_RELAY_6() SET_RELAY(6)
+#define WRITE_RELAY_6() WRITE_RELAY(6)
 #else
 #define INIT_RELAY_6()
 #define GET_RELAY_6()
 #define SET_RELAY_6()
+#define WRITE_RELAY_6()
 #endif
 
 #if NUM_RELAYS >= 7
 #define INIT_RELAY_7() INIT_RELAY(7)
 #define GET_RELAY_7() GET_RELAY(7)
 #define SET_RELAY_7() SET_RELAY(7)
+#define WRITE_RELAY_7() WRITE_RELAY(7)
 #else
 #define INIT_RELAY_7()
 #define GET_RELAY_7()
 #define SET_RELAY_7()
+#define WRITE_RELAY_7()
 #endif
 
 #if NUM_RELAYS >= 8
 #define INIT_RELAY_8() INIT_RELAY(8)
 #define GET_RELAY_8() GET_RELAY(8)
 #define SET_RELAY_8() SET_RELAY(8)
+#define WRITE_RELAY_8() WRITE_RELAY(8)
 #else
 #define INIT_RELAY_8()
 #define GET_RELAY_8()
 #define SET_RELAY_8()
+#define WRITE_RELAY_8()
 #endif
 
 #define DO_RELAY(action)                                                       \
@@ -140,11 +168,22 @@ void set_all_relays(bool on) {
   }
 }
 
-void set_relay(uint8_t relay, bool on) { DO_RELAY(SET); }
+void set_relay(uint8_t relay, bool on) {
+  /* The compiler usually sets the bits with sbi and cbi, which can't be
+   * interrupted, but nothing makes it */
+  RELAY_PORT_UPDATE { DO_RELAY(SET); }
+}
 
 uint8_t get_relay_state(void) {
   uint8_t state = 0;
 
   DO_RELAY(GET);
+#if USE_PWM
+  state |= pwm_sw_active();
+#endif
   return state;
 }
+
+#if USE_PWM
+void write_relays(uint8_t mask, uint8_t state) { DO_RELAY(WRITE); }
+#endif
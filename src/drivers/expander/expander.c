@@ -0,0 +1,384 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Driver for relays on I2C port expanders: PCF8574 (8 relays each) or
+ * MCP23017 (16 relays each), at consecutive addresses. The I2C bus is the TWI
+ * on the ATmega and the USI on the ATtiny parts.
+ *
+ * The state of the relays is kept in RAM, and changing it only marks the
+ * expander as dirty. poll_relays() writes the dirty expanders from the main
+ * loop, one at a time, so however many relays a command changes, each
+ * expander gets one write of its whole output latch. A write takes a few
+ * hundred microseconds at 100 kHz, so it is split up so that usbPoll() still
+ * runs often enough: the TWI sends each byte by itself, and poll_relays() only
+ * starts the next one. The USI must be clocked in software, so it sends one
+ * byte (about 100 us) per call. A TWI write that a slave holds up (e.g. by
+ * keeping SCL low) is abandoned after TWI_TIMEOUT_MS and tried again.
+ *
+ * At start up, flush_relays() waits for the writes, so the relays are in
+ * their initial state before the device connects to USB.
+ */
+#include <avr/io.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <util/delay.h>
+
+#include "main.h"
+#if EXPANDER_TWI
+#include "timer.h"
+#endif
+
+#define I2C_HZ 100000UL
+
+#if EXPANDER_MCP23017
+#define EXPANDER_BANKS 2
+#define MCP_IODIRA 0x00
+#define MCP_OLATA 0x14
+#else
+#define EXPANDER_BANKS 1
+#endif
+
+#define EXPANDERS ((RELAY_BANKS + EXPANDER_BANKS - 1) / EXPANDER_BANKS)
+
+#if EXPANDER_ACTIVE_LOW
+#define OUTPUT(s) ((uint8_t)~(s))
+#else
+#define OUTPUT(s) (s)
+#endif
+
+static uint8_t state[EXPANDERS * EXPANDER_BANKS];
+/* Bit n is set if the output latch of expander n must be written */
+static uint8_t dirty;
+#if EXPANDER_MCP23017
+/* Bit n is set once the pins of expander n have been made outputs */
+static uint8_t configured;
+#endif
+
+/* The write being sent: the address, then the register (MCP23017) and data */
+static uint8_t msg[2 + EXPANDER_BANKS];
+static uint8_t msg_len;
+static uint8_t msg_pos;
+static uint8_t current;
+static bool busy;
+
+/* flush_relays() gives up after long enough to send every write twice (the
+ * MCP23017 needs two), with the TWI sending a byte in about 10 polls */
+#define FLUSH_POLL_US 10
+#define FLUSH_POLLS (2 * 10 * EXPANDERS * EXPANDER_BANKS * sizeof(msg))
+
+#if EXPANDER_TWI
+#define TWI_BITRATE ((F_CPU / I2C_HZ - 16) / 2)
+_Static_assert(TWI_BITRATE >= 10 && TWI_BITRATE <= 255,
+               "I2C clock out of range for the CPU clock");
+
+#define TW_STATUS_MASK 0xF8
+#define TW_START 0x08
+#define TW_MT_SLA_ACK 0x18
+#define TW_MT_DATA_ACK 0x28
+
+/* A write takes well under a millisecond, so one that has not finished in
+ * this time never will */
+#define TWI_TIMEOUT_MS 10UL
+#define TWI_TIMEOUT_TICKS TIMER_DELAY_TICKS(TWI_TIMEOUT_MS)
+_Static_assert(TWI_TIMEOUT_TICKS <= 255, "TWI timeout does not fit the ticks");
+
+/* timer_ticks when the current (or last) write was started */
+static uint8_t twi_started;
+
+static void bus_init(void) {
+  TWBR = TWI_BITRATE;
+  TWSR = 0;
+  TWCR = _BV(TWEN);
+}
+#else
+/* The USI pins are the same on all of the supported ATtiny parts */
+#define SDA_BIT 0
+#define SCL_BIT 2
+
+/* Half periods of the I2C clock, for 100 kHz */
+#define T_LOW_US 5
+#define T_HIGH_US 4
+
+/* Longest time a slave may hold the clock low */
+#define SCL_TIMEOUT_US 100
+
+#define USI_STROBE (_BV(USIWM1) | _BV(USICS1) | _BV(USICLK) | _BV(USITC))
+#define USI_CLEAR (_BV(USISIF) | _BV(USIOIF) | _BV(USIPF))
+/* The 4 bit counter overflows after 16 clock edges (8 bits) or 2 (1 bit) */
+#define USI_8_BITS (USI_CLEAR | 0x0)
+#define USI_1_BIT (USI_CLEAR | 0xE)
+
+static void bus_init(void) {
+  PORTB |= _BV(SDA_BIT) | _BV(SCL_BIT);
+  DDRB |= _BV(SDA_BIT) | _BV(SCL_BIT);
+  USIDR = 0xFF;
+  USICR = _BV(USIWM1) | _BV(USICS1) | _BV(USICLK);
+  USISR = USI_CLEAR;
+}
+
+/* Slaves can hold the clock low until they are ready, but there is no
+ * watchdog on some boards, so one that never lets go must not hang the
+ * firmware. Returns false if the clock is still low after SCL_TIMEOUT_US */
+static bool wait_scl(void) {
+  for (uint8_t i = 0; i < SCL_TIMEOUT_US; i++) {
+    if (PINB & _BV(SCL_BIT)) {
+      return true;
+    }
+    _delay_us(1);
+  }
+  return false;
+}
+
+/* Clocks USIDR out and the bits on SDA in. Gives up if a slave holds the
+ * clock low, and returns false. Either way, SDA and SCL are released after */
+static bool usi_transfer(uint8_t status, uint8_t *data) {
+  bool ok = true;
+
+  USISR = status;
+  do {
+    _delay_us(T_LOW_US);
+    USICR = USI_STROBE;
+    if (!wait_scl()) {
+      ok = false;
+      break;
+    }
+    _delay_us(T_HIGH_US);
+    USICR = USI_STROBE;
+  } while (!(USISR & _BV(USIOIF)));
+  _delay_us(T_LOW_US);
+
+  *data = USIDR;
+  USIDR = 0xFF;
+  DDRB |= _BV(SDA_BIT);
+  return ok;
+}
+
+static bool usi_start(void) {
+  PORTB |= _BV(SCL_BIT);
+  if (!wait_scl()) {
+    return false;
+  }
+  _delay_us(T_HIGH_US);
+  PORTB &= ~_BV(SDA_BIT);
+  _delay_us(T_HIGH_US);
+  PORTB &= ~_BV(SCL_BIT);
+  PORTB |= _BV(SDA_BIT);
+  return true;
+}
+
+static void usi_stop(void) {
+  PORTB &= ~_BV(SDA_BIT);
+  PORTB |= _BV(SCL_BIT);
+  /* SDA is released even if the clock is held, so the bus is free once the
+   * slave lets go */
+  wait_scl();
+  _delay_us(T_HIGH_US);
+  PORTB |= _BV(SDA_BIT);
+  _delay_us(T_LOW_US);
+}
+
+/* Sends a byte and returns true if it was acknowledged */
+static bool usi_write(uint8_t b) {
+  uint8_t ack;
+
+  USIDR = b;
+  if (!usi_transfer(USI_8_BITS, &ack)) {
+    return false;
+  }
+  DDRB &= ~_BV(SDA_BIT);
+  return usi_transfer(USI_1_BIT, &ack) && !(ack & 1);
+}
+#endif
+
+/* Picks the next write, starting after the last expander written so that one
+ * that does not answer cannot hold up the others. The output latch of an
+ * expander is written first, so that the MCP23017 pins are never outputs
+ * with the wrong state. Returns false if there is nothing to write */
+static bool next_msg(void) {
+  for (uint8_t i = 1; i <= EXPANDERS; i++) {
+    uint8_t e = (current + i) % EXPANDERS;
+    uint8_t const *banks = &state[e * EXPANDER_BANKS];
+    uint8_t bit = _BV(e);
+
+    msg[0] = (EXPANDER_ADDRESS + e) << 1;
+    if (dirty & bit) {
+      current = e;
+      /* Changes from now on are sent by the next write */
+      dirty &= ~bit;
+#if EXPANDER_MCP23017
+      msg[1] = MCP_OLATA;
+      msg[2] = OUTPUT(banks[0]);
+      msg[3] = OUTPUT(banks[1]);
+      msg_len = 4;
+#else
+      msg[1] = OUTPUT(banks[0]);
+      msg_len = 2;
+#endif
+      return true;
+    }
+#if EXPANDER_MCP23017
+    if (!(configured & bit)) {
+      current = e;
+      msg[1] = MCP_IODIRA;
+      msg[2] = 0;
+      msg[3] = 0;
+      msg_len = 4;
+      return true;
+    }
+#endif
+  }
+  return false;
+}
+
+static void finish(bool ok) {
+  uint8_t bit = _BV(current);
+
+  busy = false;
+#if EXPANDER_MCP23017
+  if (msg[1] == MCP_IODIRA) {
+    if (ok) {
+      configured |= bit;
+    }
+    return;
+  }
+#endif
+  /* Try again. Expanders that do not answer are retried in turn with the
+   * others, which only costs bus time */
+  if (!ok) {
+    dirty |= bit;
+  }
+}
+
+void poll_relays(void) {
+#if EXPANDER_TWI
+  uint8_t status;
+  bool timed_out = (uint8_t)(timer_ticks - twi_started) >= TWI_TIMEOUT_TICKS;
+
+  if (!busy) {
+    /* The stop condition of the last write is still being sent */
+    if (TWCR & _BV(TWSTO)) {
+      if (timed_out) {
+        /* Disabling the TWI releases the bus and clears TWSTO */
+        TWCR = 0;
+      }
+      return;
+    }
+    if (!next_msg()) {
+      return;
+    }
+    busy = true;
+    msg_pos = 0;
+    twi_started = timer_ticks;
+    TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+    return;
+  }
+
+  if (!(TWCR & _BV(TWINT))) {
+    if (timed_out) {
+      TWCR = 0;
+      finish(false);
+    }
+    return;
+  }
+
+  status = TWSR & TW_STATUS_MASK;
+  if (status == (msg_pos == 0   ? TW_START
+                 : msg_pos == 1 ? TW_MT_SLA_ACK
+                                : TW_MT_DATA_ACK)) {
+    if (msg_pos < msg_len) {
+      TWDR = msg[msg_pos++];
+      TWCR = _BV(TWINT) | _BV(TWEN);
+      return;
+    }
+  }
+
+  TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+  finish(msg_pos == msg_len && status == TW_MT_DATA_ACK);
+#else
+  bool ok;
+
+  if (!busy) {
+    if (!next_msg()) {
+      return;
+    }
+    busy = true;
+    msg_pos = 0;
+    if (!usi_start()) {
+      /* The clock is held low. Try again on a later call */
+      finish(false);
+      return;
+    }
+  }
+
+  ok = usi_write(msg[msg_pos++]);
+  if (ok && msg_pos < msg_len) {
+    return;
+  }
+
+  usi_stop();
+  finish(ok);
+#endif
+}
+
+static void update_bank(uint8_t bank, uint8_t mask, uint8_t value) {
+  uint8_t s;
+
+  if (bank == RELAY_BANKS - 1 && NUM_RELAYS % 8) {
+    mask &= (1 << (NUM_RELAYS % 8)) - 1;
+  }
+
+  s = (state[bank] & ~mask) | (value & mask);
+  if (s != state[bank]) {
+    state[bank] = s;
+    dirty |= _BV(bank / EXPANDER_BANKS);
+  }
+}
+
+/* True until every expander has been written (and configured) */
+static bool pending(void) {
+#if EXPANDER_MCP23017
+  if (configured != (uint8_t)((1 << EXPANDERS) - 1)) {
+    return true;
+  }
+#endif
+  return busy || dirty;
+}
+
+void flush_relays(void) {
+  for (uint16_t i = 0; i < FLUSH_POLLS && pending(); i++) {
+    poll_relays();
+    _delay_us(FLUSH_POLL_US);
+  }
+}
+
+void init_relays(void) {
+  bus_init();
+  dirty = (1 << EXPANDERS) - 1;
+  /* Start with the first expander */
+  current = EXPANDERS - 1;
+  /* The PCF8574 outputs are high at power on, which switches on the relays
+   * of active high modules, so they are cleared straight away */
+  flush_relays();
+}
+
+void set_all_relays(bool on) {
+  for (uint8_t i = 0; i < RELAY_BANKS; i++) {
+    update_bank(i, 0xFF, on ? 0xFF : 0);
+  }
+}
+
+void set_relay(uint8_t relay, bool on) {
+  update_bank(relay / 8, _BV(relay % 8), on ? 0xFF : 0);
+}
+
+uint8_t get_relay_state(void) { return state[0]; }
+
+#if NUM_RELAYS > 8
+void write_relay_bank(uint8_t bank, uint8_t mask, uint8_t value) {
+  update_bank(bank, mask, value);
+}
+
+uint8_t get_relay_bank_state(uint8_t bank) { return state[bank]; }
+#endif
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Driver for relays on a chain of 74HC595 style shift registers, for up to 64
+ * relays from 3 or 4 pins. Relay 1 is output QA of the register nearest the
+ * AVR, relay 9 is QA of the next one, and so on. The state of the relays is
+ * kept in RAM and the whole chain is shifted out and latched on each change.
+ *
+ * The data and clock use the USI (ATtiny) or SPI (ATmega) when they are on its
+ * DO/MOSI and USCK/SCK pins, and are toggled in software otherwise. Nothing
+ * needs interrupts to be disabled, since the registers only move on the clock
+ * edges. The optional output enable pin holds the outputs off at power on,
+ * until the registers have been cleared.
+ */
+#include <avr/io.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "main.h"
+
+#define _concat(a, b) a##b
+#define concat(a, b) _concat(a, b)
+
+#define PORTn(n) concat(PORT, n)
+#define DDRn(n) concat(DDR, n)
+
+#define DATA_PORT PORTn(SHIFTREG_DATA_IOPORT_NAME)
+#define DATA_DDR DDRn(SHIFTREG_DATA_IOPORT_NAME)
+#define DATA_MASK _BV(SHIFTREG_DATA_BIT)
+
+#define CLOCK_PORT PORTn(SHIFTREG_CLOCK_IOPORT_NAME)
+#define CLOCK_DDR DDRn(SHIFTREG_CLOCK_IOPORT_NAME)
+#define CLOCK_MASK _BV(SHIFTREG_CLOCK_BIT)
+
+#define LATCH_PORT PORTn(SHIFTREG_LATCH_IOPORT_NAME)
+#define LATCH_DDR DDRn(SHIFTREG_LATCH_IOPORT_NAME)
+#define LATCH_MASK _BV(SHIFTREG_LATCH_BIT)
+
+#ifdef SHIFTREG_OE_IOPORT_NAME
+#define OE_PORT PORTn(SHIFTREG_OE_IOPORT_NAME)
+#define OE_DDR DDRn(SHIFTREG_OE_IOPORT_NAME)
+#define OE_MASK _BV(SHIFTREG_OE_BIT)
+#endif
+
+static uint8_t state[RELAY_BANKS];
+
+static void shift(uint8_t b) {
+#if SHIFTREG_USI
+  USIDR = b;
+  USISR = _BV(USIOIF);
+  do {
+    USICR = _BV(USIWM0) | _BV(USICS1) | _BV(USICLK) | _BV(USITC);
+  } while (!(USISR & _BV(USIOIF)));
+#elif SHIFTREG_SPI
+  SPDR = b;
+  while (!(SPSR & _BV(SPIF))) {
+  }
+#else
+  for (uint8_t i = 0; i < 8; i++) {
+    if (b & 0x80) {
+      DATA_PORT |= DATA_MASK;
+    } else {
+      DATA_PORT &= ~DATA_MASK;
+    }
+    CLOCK_PORT |= CLOCK_MASK;
+    CLOCK_PORT &= ~CLOCK_MASK;
+    b <<= 1;
+  }
+#endif
+}
+
+/* Shifts out the state of every relay, the last register first */
+static void flush(void) {
+  for (uint8_t i = RELAY_BANKS; i > 0; i--) {
+    shift(state[i - 1]);
+  }
+  LATCH_PORT |= LATCH_MASK;
+  LATCH_PORT &= ~LATCH_MASK;
+}
+
+void init_relays(void) {
+#ifdef SHIFTREG_OE_IOPORT_NAME
+  /* Off until the registers have been cleared, in case the pin has no pull
+   * up */
+  OE_PORT |= OE_MASK;
+  OE_DDR |= OE_MASK;
+#endif
+  DATA_DDR |= DATA_MASK;
+  CLOCK_DDR |= CLOCK_MASK;
+  LATCH_DDR |= LATCH_MASK;
+
+#if SHIFTREG_SPI
+  /* SS must be an output to stay in master mode. SCK / 2 */
+  DDRB |= _BV(2);
+  SPCR = _BV(SPE) | _BV(MSTR);
+  SPSR = _BV(SPI2X);
+#endif
+
+  set_all_relays(false);
+
+#ifdef SHIFTREG_OE_IOPORT_NAME
+  OE_PORT &= ~OE_MASK;
+#endif
+}
+
+void set_all_relays(bool on) {
+  memset(state, on ? 0xFF : 0, sizeof(state));
+#if NUM_RELAYS % 8
+  state[RELAY_BANKS - 1] &= (1 << (NUM_RELAYS % 8)) - 1;
+#endif
+  flush();
+}
+
+void set_relay(uint8_t relay, bool on) {
+  uint8_t mask = _BV(relay % 8);
+
+  if (on) {
+    state[relay / 8] |= mask;
+  } else {
+    state[relay / 8] &= ~mask;
+  }
+  flush();
+}
+
+uint8_t get_relay_state(void) { return state[0]; }
+
+#if NUM_RELAYS > 8
+void write_relay_bank(uint8_t bank, uint8_t mask, uint8_t value) {
+  if (bank == RELAY_BANKS - 1 && NUM_RELAYS % 8) {
+    mask &= (1 << (NUM_RELAYS % 8)) - 1;
+  }
+  state[bank] = (state[bank] & ~mask) | (value & mask);
+  flush();
+}
+
+uint8_t get_relay_bank_state(uint8_t bank) { return state[bank]; }
+#endif
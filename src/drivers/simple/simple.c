@@ -15,6 +15,10 @@
 
 #include "main.h"
 
+#if USE_PWM
+#include "pwm.h"
+#endif
+
 #define _concat(a, b) a##b
 #define concat(a, b) _concat(a, b)
 
@@ -30,29 +34,42 @@ void init_relays(void) {
 }
 
 void set_all_relays(bool on) {
-  if (on) {
 #if NUM_RELAYS == 8
-    RELAY_PORT = 0xFF;
+  RELAY_PORT = on ? 0xFF : 0;
 #else
-    RELAY_PORT |= RELAY_MASK;
-#endif
-  } else {
-#if NUM_RELAYS == 8
-    RELAY_PORT = 0;
-#else
-    RELAY_PORT &= ~RELAY_MASK;
-#endif
+  RELAY_PORT_UPDATE {
+    if (on) {
+      RELAY_PORT |= RELAY_MASK;
+    } else {
+      RELAY_PORT &= ~RELAY_MASK;
+    }
   }
+#endif
 }
 
 void set_relay(uint8_t relay, bool on) {
-  if (on) {
-    RELAY_PORT |= _BV(relay + RELAY_OFFSET);
-  } else {
-    RELAY_PORT &= ~_BV(relay + RELAY_OFFSET);
+  uint8_t bit = _BV(relay + RELAY_OFFSET);
+
+  RELAY_PORT_UPDATE {
+    if (on) {
+      RELAY_PORT |= bit;
+    } else {
+      RELAY_PORT &= ~bit;
+    }
   }
 }
 
 uint8_t get_relay_state(void) {
+#if USE_PWM
+  return ((RELAY_PORT & RELAY_MASK) >> RELAY_OFFSET) | pwm_sw_active();
+#else
   return (RELAY_PORT & RELAY_MASK) >> RELAY_OFFSET;
+#endif
 }
+
+#if USE_PWM
+void write_relays(uint8_t mask, uint8_t state) {
+  RELAY_PORT = (RELAY_PORT & ~(mask << RELAY_OFFSET)) |
+               ((state & mask) << RELAY_OFFSET);
+}
+#endif
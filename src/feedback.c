@@ -0,0 +1,188 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "feedback.h"
+
+#include <avr/io.h>
+
+#include "reports.h"
+#include "timer.h"
+
+#define _concat(a, b) a##b
+#define concat(a, b) _concat(a, b)
+
+#define _threecat(a, b, c) a##b##c
+#define threecat(a, b, c) _threecat(a, b, c)
+
+#define FEEDBACK_IOPORT_NAME(n) threecat(RELAY_, n, _FEEDBACK_IOPORT_NAME)
+
+#define FEEDBACK_DDR(n) concat(DDR, FEEDBACK_IOPORT_NAME(n))
+#define FEEDBACK_PORT(n) concat(PORT, FEEDBACK_IOPORT_NAME(n))
+#define FEEDBACK_PIN(n) concat(PIN, FEEDBACK_IOPORT_NAME(n))
+#define FEEDBACK_MASK(n) (1 << threecat(RELAY_, n, _FEEDBACK_BIT))
+
+#define INIT_FEEDBACK(n)                                                       \
+  FEEDBACK_DDR(n) &= ~FEEDBACK_MASK(n);                                        \
+  if (FEEDBACK_PULLUPS & (1 << (n - 1))) {                                     \
+    FEEDBACK_PORT(n) |= FEEDBACK_MASK(n);                                      \
+  }
+
+#define READ_FEEDBACK(n)                                                       \
+  if (FEEDBACK_PIN(n) & FEEDBACK_MASK(n)) {                                    \
+    sensed |= (1 << (n - 1));                                                  \
+  }
+
+#ifdef RELAY_1_FEEDBACK_IOPORT_NAME
+#define INIT_FEEDBACK_1() INIT_FEEDBACK(1)
+#define READ_FEEDBACK_1() READ_FEEDBACK(1)
+#else
+#define INIT_FEEDBACK_1()
+#define READ_FEEDBACK_1()
+#endif
+
+#ifdef RELAY_2_FEEDBACK_IOPORT_NAME
+#define INIT_FEEDBACK_2() INIT_FEEDBACK(2)
+#define READ_FEEDBACK_2() READ_FEEDBACK(2)
+#else
+#define INIT_FEEDBACK_2()
+#define READ_FEEDBACK_2()
+#endif
+
+#ifdef RELAY_3_FEEDBACK_IOPORT_NAME
+#define INIT_FEEDBACK_3() INIT_FEEDBACK(3)
+#define READ_FEEDBACK_3() READ_FEEDBACK(3)
+#else
+#define INIT_FEEDBACK_3()
+#define READ_FEEDBACK_3()
+#endif
+
+#ifdef RELAY_4_FEEDBACK_IOPORT_NAME
+#define INIT_FEEDBACK_4() INIT_FEEDBACK(4)
+#define READ_FEEDBACK_4() READ_FEEDBACK(4)
+#else
+#define INIT_FEEDBACK_4()
+#define READ_FEEDBACK_4()
+#endif
+
+#ifdef RELAY_5_FEEDBACK_IOPORT_NAME
+#define INIT_FEEDBACK_5() INIT_FEEDBACK(5)
+#define READ_FEEDBACK_5() READ_FEEDBACK(5)
+#else
+#define INIT_FEEDBACK_5()
+#define READ_FEEDBACK_5()
+#endif
+
+#ifdef RELAY_6_FEEDBACK_IOPORT_NAME
+#define INIT_FEEDBACK_6() INIT_FEEDBACK(6)
+#define READ_FEEDBACK_6() READ_FEEDBACK(6)
+#else
+#define INIT_FEEDBACK_6()
+#define READ_FEEDBACK_6()
+#endif
+
+#ifdef RELAY_7_FEEDBACK_IOPORT_NAME
+#define INIT_FEEDBACK_7() INIT_FEEDBACK(7)
+#define READ_FEEDBACK_7() READ_FEEDBACK(7)
+#else
+#define INIT_FEEDBACK_7()
+#define READ_FEEDBACK_7()
+#endif
+
+#ifdef RELAY_8_FEEDBACK_IOPORT_NAME
+#define INIT_FEEDBACK_8() INIT_FEEDBACK(8)
+#define READ_FEEDBACK_8() READ_FEEDBACK(8)
+#else
+#define INIT_FEEDBACK_8()
+#define READ_FEEDBACK_8()
+#endif
+
+#define DO_FEEDBACK(action)                                                    \
+  concat(action, _FEEDBACK_1)();                                               \
+  concat(action, _FEEDBACK_2)();                                               \
+  concat(action, _FEEDBACK_3)();                                               \
+  concat(action, _FEEDBACK_4)();                                               \
+  concat(action, _FEEDBACK_5)();                                               \
+  concat(action, _FEEDBACK_6)();                                               \
+  concat(action, _FEEDBACK_7)();                                               \
+  concat(action, _FEEDBACK_8)();
+
+struct feedback_stats feedback_stats = {.report_id = REPORT_ID_FEEDBACK};
+
+static uint8_t commanded;
+/* Relays that have switched but whose feedback has not followed yet */
+static uint8_t waiting;
+/* Relays that are still within the settle time */
+static uint8_t settling;
+static uint16_t settle[NUM_RELAYS];
+static uint16_t switched_at[NUM_RELAYS];
+
+/* A relay stops waiting for its edge one tick after the settle time at the
+ * latest, which must be before timer_stamp() wraps around */
+_Static_assert(TIMER_DELAY_TICKS(FEEDBACK_SETTLE_MS) + 1 <= 256,
+               "Settle time too long to measure the latency at F_CPU");
+
+static uint8_t read_feedback(void) {
+  uint8_t sensed = 0;
+
+  DO_FEEDBACK(READ);
+  return (sensed ^ FEEDBACK_INVERTS) & RELAY_FEEDBACK_MASK;
+}
+
+void init_feedback(void) { DO_FEEDBACK(INIT); }
+
+void feedback_switched(uint8_t relay, bool on) {
+  uint8_t bit = 1 << relay;
+
+  if (!(RELAY_FEEDBACK_MASK & bit)) {
+    return;
+  }
+
+  switched_at[relay] = timer_stamp();
+  settle[relay] = TIMER_DELAY_TICKS(FEEDBACK_SETTLE_MS);
+  commanded = on ? commanded | bit : commanded & ~bit;
+  waiting |= bit;
+  settling |= bit;
+}
+
+void feedback_poll(uint8_t elapsed) {
+  uint8_t differs = read_feedback() ^ commanded;
+  uint8_t edges = waiting & ~differs;
+
+  if (edges) {
+    uint16_t now = timer_stamp();
+
+    for (uint8_t i = 0; i < NUM_RELAYS; i++) {
+      if (edges & (1 << i)) {
+        uint16_t latency = now - switched_at[i];
+
+        feedback_stats.latency[i] = latency;
+        if (latency > feedback_stats.max_latency[i]) {
+          feedback_stats.max_latency[i] = latency;
+        }
+      }
+    }
+    waiting &= ~edges;
+  }
+
+  if (!elapsed) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < NUM_RELAYS; i++) {
+    if (settling & (1 << i)) {
+      if (settle[i] > elapsed) {
+        settle[i] -= elapsed;
+      } else {
+        settling &= ~(1 << i);
+        /* A relay that never followed has no meaningful latency */
+        waiting &= ~(1 << i);
+      }
+    }
+  }
+
+  /* Outside of the settle time, the contacts must follow the command */
+  feedback_stats.mismatch =
+      (feedback_stats.mismatch & settling) | (differs & ~settling);
+}
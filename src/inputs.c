@@ -0,0 +1,149 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "inputs.h"
+
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include "timer.h"
+
+#define _concat(a, b) a##b
+#define concat(a, b) _concat(a, b)
+
+#define _threecat(a, b, c) a##b##c
+#define threecat(a, b, c) _threecat(a, b, c)
+
+#define INPUT_IOPORT_NAME(n) threecat(INPUT_, n, _IOPORT_NAME)
+
+#define INPUT_DDR(n) concat(DDR, INPUT_IOPORT_NAME(n))
+#define INPUT_PORT(n) concat(PORT, INPUT_IOPORT_NAME(n))
+#define INPUT_PIN(n) concat(PIN, INPUT_IOPORT_NAME(n))
+#define INPUT_MASK(n) (1 << threecat(INPUT_, n, _BIT))
+
+#define INIT_INPUT(n)                                                          \
+  INPUT_DDR(n) &= ~INPUT_MASK(n);                                              \
+  if (INPUT_PULLUPS & (1 << (n - 1))) {                                        \
+    INPUT_PORT(n) |= INPUT_MASK(n);                                            \
+  }
+
+#define READ_INPUT(n)                                                          \
+  if (INPUT_PIN(n) & INPUT_MASK(n)) {                                          \
+    raw |= (1 << (n - 1));                                                     \
+  }
+
+#define INIT_INPUT_1() INIT_INPUT(1)
+#define READ_INPUT_1() READ_INPUT(1)
+
+#if NUM_INPUTS >= 2
+#define INIT_INPUT_2() INIT_INPUT(2)
+#define READ_INPUT_2() READ_INPUT(2)
+#else
+#define INIT_INPUT_2()
+#define READ_INPUT_2()
+#endif
+
+#if NUM_INPUTS >= 3
+#define INIT_INPUT_3() INIT_INPUT(3)
+#define READ_INPUT_3() READ_INPUT(3)
+#else
+#define INIT_INPUT_3()
+#define READ_INPUT_3()
+#endif
+
+#if NUM_INPUTS >= 4
+#define INIT_INPUT_4() INIT_INPUT(4)
+#define READ_INPUT_4() READ_INPUT(4)
+#else
+#define INIT_INPUT_4()
+#define READ_INPUT_4()
+#endif
+
+#if NUM_INPUTS >= 5
+#define INIT_INPUT_5() INIT_INPUT(5)
+#define READ_INPUT_5() READ_INPUT(5)
+#else
+#define INIT_INPUT_5()
+#define READ_INPUT_5()
+#endif
+
+#if NUM_INPUTS >= 6
+#define INIT_INPUT_6() INIT_INPUT(6)
+#define READ_INPUT_6() READ_INPUT(6)
+#else
+#define INIT_INPUT_6()
+#define READ_INPUT_6()
+#endif
+
+#if NUM_INPUTS >= 7
+#define INIT_INPUT_7() INIT_INPUT(7)
+#define READ_INPUT_7() READ_INPUT(7)
+#else
+#define INIT_INPUT_7()
+#define READ_INPUT_7()
+#endif
+
+#if NUM_INPUTS >= 8
+#define INIT_INPUT_8() INIT_INPUT(8)
+#define READ_INPUT_8() READ_INPUT(8)
+#else
+#define INIT_INPUT_8()
+#define READ_INPUT_8()
+#endif
+
+#define DO_INPUT(action)                                                       \
+  concat(action, _INPUT_1)();                                                  \
+  concat(action, _INPUT_2)();                                                  \
+  concat(action, _INPUT_3)();                                                  \
+  concat(action, _INPUT_4)();                                                  \
+  concat(action, _INPUT_5)();                                                  \
+  concat(action, _INPUT_6)();                                                  \
+  concat(action, _INPUT_7)();                                                  \
+  concat(action, _INPUT_8)();
+
+#define DEBOUNCE_TICKS TIMER_DELAY_TICKS(INPUT_DEBOUNCE_MS)
+
+static uint8_t state;
+/* Ticks each input has differed from the debounced state */
+static uint16_t unstable[NUM_INPUTS];
+
+static uint8_t read_inputs(void) {
+  uint8_t raw = 0;
+
+  DO_INPUT(READ);
+  return raw ^ INPUT_INVERTS;
+}
+
+void init_inputs(void) {
+  DO_INPUT(INIT);
+  /* Give the pull ups time to charge the input lines */
+  _delay_us(10);
+  state = read_inputs();
+}
+
+void inputs_poll(uint8_t elapsed) {
+  uint8_t changed;
+
+  if (!elapsed) {
+    return;
+  }
+
+  changed = read_inputs() ^ state;
+
+  for (uint8_t i = 0; i < NUM_INPUTS; i++) {
+    uint8_t bit = 1 << i;
+
+    if (!(changed & bit)) {
+      unstable[i] = 0;
+    } else if (unstable[i] + elapsed >= DEBOUNCE_TICKS) {
+      state ^= bit;
+      unstable[i] = 0;
+    } else {
+      unstable[i] += elapsed;
+    }
+  }
+}
+
+uint8_t get_input_state(void) { return state; }
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "macros.h"
+
+#include <avr/eeprom.h>
+
+#include "relays.h"
+#include "reports.h"
+#include "timer.h"
+
+static struct relay_macro EEMEM saved_macros[NUM_MACROS];
+/* Sum of the bytes of each slot. It holds for the cleared slots of the EEPROM
+ * image but not for an erased EEPROM (all 0xFF), which would otherwise turn
+ * every relay on */
+static uint8_t EEMEM saved_sums[NUM_MACROS];
+
+struct macros_report macros_report = {
+    .report_id = REPORT_ID_MACROS,
+    .running = MACRO_NONE,
+};
+
+/* Ticks remaining before the running slot is applied */
+static uint16_t countdown;
+
+static void step(uint8_t index) {
+  struct relay_macro const *m = &macros_report.macros[index];
+  uint16_t delay_ms = m->delay_ms;
+
+  relays_request(m->care & RELAY_ALL_MASK, m->mask);
+
+  if (m->next >= NUM_MACROS) {
+    macros_report.running = MACRO_NONE;
+    return;
+  }
+
+  if (delay_ms > MACRO_MAX_DELAY_MS) {
+    delay_ms = MACRO_MAX_DELAY_MS;
+  }
+  macros_report.running = m->next;
+  countdown = TIMER_DELAY_TICKS((uint32_t)delay_ms);
+}
+
+static uint8_t sum(struct relay_macro const *m) {
+  uint8_t const *p = (uint8_t const *)m;
+  uint8_t s = 0;
+
+  for (uint8_t i = 0; i < sizeof(*m); i++) {
+    s += p[i];
+  }
+  return s;
+}
+
+void init_macros(void) {
+  eeprom_read_block(macros_report.macros, saved_macros, sizeof(saved_macros));
+  for (uint8_t i = 0; i < NUM_MACROS; i++) {
+    struct relay_macro *m = &macros_report.macros[i];
+
+    /* Invalid slots are cleared so that running them does nothing */
+    if (sum(m) != eeprom_read_byte(&saved_sums[i])) {
+      m->mask = 0;
+      m->care = 0;
+      m->next = MACRO_NONE;
+      m->delay_ms = 0;
+    }
+  }
+}
+
+void macros_set(uint8_t index, struct relay_macro const *m) {
+  /* Editing the table stops a sequence that may be running through it */
+  macros_report.running = MACRO_NONE;
+  macros_report.macros[index] = *m;
+  /* The sum is written last, so a slot that was only partly written when the
+   * power failed is not run */
+  eeprom_update_block(m, &saved_macros[index], sizeof(*m));
+  eeprom_update_byte(&saved_sums[index], sum(m));
+}
+
+void macros_run(uint8_t index) {
+  if (index < NUM_MACROS) {
+    step(index);
+  } else {
+    macros_report.running = MACRO_NONE;
+  }
+}
+
+void macros_poll(uint8_t elapsed) {
+  if (macros_report.running == MACRO_NONE) {
+    return;
+  }
+
+  if (countdown > elapsed) {
+    countdown -= elapsed;
+  } else {
+    step(macros_report.running);
+  }
+}
@@ -13,8 +13,40 @@
 #include <string.h>
 #include <util/delay.h>
 
+#if NUM_ADC_CHANNELS
+#include "adc.h"
+#endif
+#if BOOTLOADER
+#include "bootloader.h"
+#endif
+#if CHAIN_BOARDS
+#include "chain.h"
+#endif
+#include "command.h"
+#if NUM_COUNTERS
+#include "counters.h"
+#endif
+#include "feedback.h"
+#include "inputs.h"
+#if NUM_MACROS
+#include "macros.h"
+#endif
 #include "oddebug.h"
+#include "pwm.h"
+#include "relays.h"
+#include "reports.h"
+#if NUM_RULES
+#include "rules.h"
+#endif
+#include "timer.h"
+#if TRACE_ENTRIES
+#include "trace.h"
+#endif
+#if UART_TRANSPORT
+#include "uart.h"
+#endif
 #include "usbdrv.h"
+#include "wear.h"
 
 #define _concat(a, b) a##b
 #define concat(a, b) _concat(a, b)
@@ -38,13 +70,6 @@
 #define GET_REPORT 1
 #define SET_REPORT 9
 
-#define CMD_SET_SERIAL 0xFA
-#define CMD_ON 0xFF
-#define CMD_OFF 0xFD
-
-#define CMD_ALL_ON 0xFE
-#define CMD_ALL_OFF 0xFC
-
 PROGMEM const char usbHidReportDescriptor[] = {
     // clang-format off
     0x06, 0x00, 0xFF,  // Usage Page (Vendor Defined 0xFF00)
@@ -56,6 +81,10 @@ PROGMEM const char usbHidReportDescriptor[] = {
     0x95, 0x08,        //   Report Count (8)
     0x09, 0x00,        //   Usage (0x00)
     0xB2, 0x02, 0x01,  //   Feature (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null Position,Non-volatile,Buffered Bytes)
+#if USB_INTR_REPORTS
+    0x09, 0x00,        //   Usage (0x00)
+    0x81, 0x02,        //   Input (Data,Var,Abs,No Wrap,Linear,Preferred State,No Null Position)
+#endif
     0xC0,              // End Collection
     // clang-format on
 };
@@ -64,9 +93,6 @@ _Static_assert(sizeof(usbHidReportDescriptor) ==
                "usbHidReportDescriptor length does not match "
                "USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH");
 
-uint8_t EEMEM serial[] = {'J', 'P', 'E', 'W', '0'};
-_Static_assert(sizeof(serial) == SERIAL_LEN, "Invalid serial number length");
-
 #if CALIBRATE_OSCILLATOR
 uint8_t EEMEM saved_osccal = 0xFF;
 #endif
@@ -81,67 +107,72 @@ void set_ram_serial(uint8_t const *data) {
 }
 #endif
 
-void set_serial(uint8_t const *data) {
-  eeprom_update_block(data, serial, SERIAL_LEN);
-#if REPORT_SERIAL
-  set_ram_serial(data);
+#if USB_ERROR_COUNTERS
+struct usb_stats {
+  uint8_t report_id;
+  /* Packets dropped by the CHECK_CRC test */
+  uint16_t crc_errors;
+  /* SETUP packets dropped because they were not 8 bytes */
+  uint16_t bad_setups;
+  /* Commands rejected with a STALL */
+  uint16_t stalls;
+  /* Bus resets by the host */
+  uint16_t bus_resets;
+};
+
+static struct usb_stats usb_stats = {.report_id = REPORT_ID_USB_STATS};
 #endif
-}
 
-uchar usbFunctionWrite(uchar *data, uchar len) {
-  if (len < 1) {
-    return 0xff;
+#if BOOTLOADER
+/* Resets into the bootloader once the host has seen the command complete */
+static void start_bootloader(void) {
+  for (uint8_t i = 0; i < 20; i++) {
+    usbPoll();
+    _delay_us(100);
   }
+#if UART_TRANSPORT
+  while (uart_busy()) {
+  }
+#endif
 
-  switch (data[0]) {
-  case CMD_SET_SERIAL:
-    if (len < 8) {
-      return 0xff;
-    }
-
-    set_serial(&data[1]);
-    return 1;
-
-  case CMD_ALL_OFF:
-    set_all_relays(false);
-    return 1;
-
-  case CMD_ALL_ON:
-    set_all_relays(true);
-    return 1;
+  BOOTLOADER_REQUEST = BOOTLOADER_MAGIC;
+  wdt_enable(WDTO_15MS);
+  while (true) {
+  }
+}
+#endif
 
-  case CMD_ON:
-  case CMD_OFF:
-    if (len < 2) {
-      return 0xff;
-    }
+uchar usbFunctionWrite(uchar *data, uchar len) {
+  uchar ret = command_handle(data, len);
 
-    if (data[1] >= 1 && data[1] <= NUM_RELAYS) {
-      set_relay(data[1] - 1, data[0] == CMD_ON);
-    }
-    return 1;
+#if USB_ERROR_COUNTERS
+  if (ret == COMMAND_REJECTED) {
+    usb_stats.stalls++;
   }
-
-  // Unknown command
-  return 0xff;
+#endif
+  return ret;
 }
 
 usbMsgLen_t usbFunctionSetup(uchar data[8]) {
   usbRequest_t *rq = (void *)data;
-  static uint8_t reply_buf[8];
 
   if ((rq->bmRequestType & USBRQ_TYPE_MASK) == USBRQ_TYPE_CLASS) {
     DBG1(0x50, &rq->bRequest, 1); /* debug output: print our request */
     if (rq->bRequest == GET_REPORT) {
-      if (rq->wValue.bytes[0] == 0 &&
-          rq->wValue.bytes[1] == USB_HID_REPORT_TYPE_FEATURE) {
-        eeprom_read_block(reply_buf, serial, SERIAL_LEN);
-        reply_buf[6] = 0;
-        reply_buf[7] = get_relay_state();
-
-        usbMsgPtr = reply_buf;
+      if (rq->wValue.bytes[1] == USB_HID_REPORT_TYPE_FEATURE) {
+#if USB_ERROR_COUNTERS
+        if (rq->wValue.bytes[0] == REPORT_ID_USB_STATS) {
+          usbMsgPtr = (uchar *)&usb_stats;
+          return sizeof(usb_stats);
+        }
+#endif
+        uint8_t const *report;
+        uint8_t len = command_report(rq->wValue.bytes[0], &report);
 
-        return 8;
+        if (len) {
+          usbMsgPtr = (uchar *)report;
+        }
+        return len;
       }
 
     } else if (rq->bRequest == SET_REPORT) {
@@ -243,7 +274,7 @@ static void calibrateOscillator() {
  * e.g. ATTiny25, ATTiny45, ATTiny85), it may be useful to search for the
  * optimum in both regions.
  */
-void usbEventResetReady(void) {
+static void calibrate(void) {
   /* Disable interrupts during oscillator calibration since
    * usbMeasureFrameLength() counts CPU cycles.
    */
@@ -256,9 +287,187 @@ void usbEventResetReady(void) {
 
 #endif
 
+#if CALIBRATE_OSCILLATOR || TRACE_ENTRIES || USB_ERROR_COUNTERS
+void usbEventResetReady(void) {
+#if CALIBRATE_OSCILLATOR
+  calibrate();
+#endif
+#if TRACE_ENTRIES
+  trace_add(TRACE_BUS_RESET, 0, 0);
+#endif
+#if USB_ERROR_COUNTERS
+  usb_stats.bus_resets++;
+#endif
+}
+#endif
+
+#if TRACE_ENTRIES || USB_ERROR_COUNTERS
+void usbEventCrcError(uchar len) {
+#if TRACE_ENTRIES
+  trace_add(TRACE_CRC_ERROR, usbRxToken, len);
+#endif
+#if USB_ERROR_COUNTERS
+  usb_stats.crc_errors++;
+#endif
+  (void)len;
+}
+
+void usbEventBadSetup(uchar len) {
+#if TRACE_ENTRIES
+  trace_add(TRACE_BAD_SETUP, len, 0);
+#endif
+#if USB_ERROR_COUNTERS
+  usb_stats.bad_setups++;
+#endif
+  (void)len;
+}
+#endif
+
+#if USE_TIMER
+/* Advances everything that runs from the system tick */
+static void poll_timers(uint8_t elapsed) {
+  (void)elapsed;
+
+#if RELAY_SCHEDULER
+  relays_poll(elapsed);
+#endif
+#if NUM_INPUTS
+  inputs_poll(elapsed);
+#endif
+#if NUM_RULES
+  rules_poll(elapsed);
+#endif
+#if NUM_MACROS
+  macros_poll(elapsed);
+#endif
+#if RELAY_FEEDBACK_MASK
+  feedback_poll(elapsed);
+#endif
+#if RELAY_WEAR_COUNTERS
+  wear_poll(elapsed);
+#endif
+#if TRACE_ENTRIES
+  trace_poll(elapsed);
+#endif
+#if UART_TRANSPORT
+  uart_poll(elapsed);
+#endif
+#if CHAIN_BOARDS
+  chain_poll(elapsed);
+#endif
+}
+#endif
+
+#if USB_INTR_REPORTS
+/*
+ * Sends an input report on the interrupt endpoint whenever the state of the
+ * inputs changes, or an analog window completes. A change that happens while
+ * the endpoint is busy is sent once it is free again
+ */
+static void poll_interrupt_reports(void) {
+  if (!usbInterruptIsReady()) {
+    return;
+  }
+
+#if NUM_INPUTS
+  {
+    static uint8_t last_inputs;
+    uint8_t inputs = get_input_state();
+
+    if (inputs != last_inputs) {
+      uint8_t buf[8] = {INTR_REPORT_INPUTS, inputs, get_relay_state()};
+
+      usbSetInterrupt(buf, sizeof(buf));
+      last_inputs = inputs;
+      return;
+    }
+  }
+#endif
+
+#if NUM_ADC_CHANNELS
+  for (uint8_t i = 0; i < NUM_ADC_CHANNELS; i++) {
+    if (adc_updated & (1 << i)) {
+      uint8_t buf[8] = {INTR_REPORT_ADC, i};
+
+      memcpy(&buf[2], &adc_report.results[i], sizeof(struct adc_result));
+      usbSetInterrupt(buf, sizeof(buf));
+      adc_updated &= ~(1 << i);
+      return;
+    }
+  }
+#endif
+}
+#endif
+
 int main(void) {
+#if TRACE_ENTRIES
+#ifdef MCUSR
+  trace_add(TRACE_BOOT, MCUSR, 0);
+  MCUSR = 0;
+#else
+  trace_add(TRACE_BOOT, MCUCSR, 0);
+  MCUCSR = 0;
+#endif
+#endif
+
+#if BOOTLOADER
+  /* The bootloader starts the application with a watchdog reset, after which
+   * the watchdog stays on until WDRF is cleared */
+#ifdef MCUSR
+  MCUSR = 0;
+#else
+  MCUCSR = 0;
+#endif
+  wdt_disable();
+#endif
+
   init_relays();
 
+  /* Everything the relay scheduler calls when a relay switches must be ready
+   * before init_commands() applies the power on state */
+#if USE_PWM
+  pwm_init();
+#endif
+
+#if RELAY_WEAR_COUNTERS
+  init_wear();
+#endif
+
+#if RELAY_FEEDBACK_MASK
+  init_feedback();
+#endif
+
+  init_commands();
+
+#if RELAY_DRIVER_POLL
+  /* The power on state must reach the relays before USB connects */
+  flush_relays();
+#endif
+
+#if NUM_INPUTS
+  init_inputs();
+#endif
+
+#if NUM_RULES
+  init_rules();
+#endif
+
+#if NUM_MACROS
+  init_macros();
+#endif
+
+#if NUM_COUNTERS
+  init_counters();
+#endif
+
+#if NUM_ADC_CHANNELS
+  init_adc();
+#endif
+
+#if UART_TRANSPORT
+  init_uart();
+#endif
+
 #ifdef LED_IOPORT_NAME
   LED_DDR |= LED_MASK;
   LED_PORT &= ~LED_MASK;
@@ -271,7 +480,7 @@ int main(void) {
     usbDescriptorStringSerialNumber[0] =
         USB_STRING_DESCRIPTOR_HEADER(SERIAL_LEN);
 
-    eeprom_read_block(buf, serial, SERIAL_LEN);
+    get_serial(buf);
     set_ram_serial(buf);
   }
 #endif
@@ -299,6 +508,10 @@ int main(void) {
     _delay_ms(1);
   }
 
+#if USE_TIMER
+  timer_init();
+#endif
+
   usbDeviceConnect();
   sei();
 
@@ -307,5 +520,27 @@ int main(void) {
     wdt_reset();
 #endif
     usbPoll();
+
+#if RELAY_DRIVER_POLL
+    poll_relays();
+#endif
+
+#if NUM_ADC_CHANNELS
+    adc_poll();
+#endif
+
+#if USE_TIMER
+    poll_timers(timer_elapsed());
+#endif
+
+#if USB_INTR_REPORTS
+    poll_interrupt_reports();
+#endif
+
+#if BOOTLOADER
+    if (bootloader_requested) {
+      start_bootloader();
+    }
+#endif
   }
 }
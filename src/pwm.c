@@ -0,0 +1,186 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * The software PWM engine uses bit angle modulation: each of the upper 7 bits
+ * of the duty cycle is output for a time proportional to its weight, so a
+ * whole period only takes 7 short interrupts regardless of how many relays
+ * are modulated. The interrupt re-enables interrupts first so that it never
+ * delays the V-USB interrupt, and masks itself while it runs so that it can't
+ * nest when a USB transfer holds it past the next compare match.
+ */
+#include "pwm.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "main.h"
+
+static const uint8_t channels[NUM_RELAYS] PROGMEM = {RELAY_PWM_CHANNELS};
+
+#if PWM_HW_CHANNELS
+#if defined(TCCR1D)
+/* ATtiny261/461/861: OCR1C is the top of the high speed Timer 1 */
+#define OC1A_CTRL TCCR1A
+#define OC1A_COM _BV(COM1A1)
+#define OC1B_CTRL TCCR1A
+#define OC1B_COM _BV(COM1B1)
+#define OC1D_CTRL TCCR1C
+#define OC1D_COM _BV(COM1D1)
+
+static void hw_init(void) {
+  OCR1C = 0xFF;
+  TCCR1A = _BV(PWM1A) | _BV(PWM1B);
+  TCCR1C = _BV(PWM1D);
+  TCCR1B = _BV(CS10);
+}
+#elif defined(TCCR1)
+/* ATtiny25/45/85: OCR1C is the top of Timer 1 */
+#define OC1A_CTRL TCCR1
+#define OC1A_COM _BV(COM1A1)
+#define OC1B_CTRL GTCCR
+#define OC1B_COM _BV(COM1B1)
+
+static void hw_init(void) {
+  OCR1C = 0xFF;
+  GTCCR |= _BV(PWM1B);
+  TCCR1 = _BV(PWM1A) | _BV(CS10);
+}
+#else
+/* ATmega: 16-bit Timer 1 in 8-bit fast PWM mode */
+#define OC1A_CTRL TCCR1A
+#define OC1A_COM _BV(COM1A1)
+#define OC1B_CTRL TCCR1A
+#define OC1B_COM _BV(COM1B1)
+
+static void hw_init(void) {
+  TCCR1A = _BV(WGM10);
+  TCCR1B = _BV(WGM12) | _BV(CS10);
+}
+#endif
+
+#define SET_HW_CHANNEL(ocr, ctrl, com)                                         \
+  if (duty == PWM_FULL) {                                                      \
+    ctrl &= ~(com);                                                            \
+  } else {                                                                     \
+    ocr = duty;                                                                \
+    ctrl |= (com);                                                             \
+  }
+#endif /* PWM_HW_CHANNELS */
+
+#if PWM_SW_MASK
+#if defined(OCR0A)
+/* Shares Timer 0 with the system tick, see timer.h */
+#define PWM_OCR OCR0A
+#define PWM_TCNT TCNT0
+#define PWM_vect TIMER0_COMPA_vect
+#if defined(TIMSK0)
+#define PWM_TIMSK TIMSK0
+#else
+#define PWM_TIMSK TIMSK
+#endif
+#define PWM_OCIE _BV(OCIE0A)
+#else
+/* Timer 0 has no compare unit on the ATmega8, so use Timer 2 with the same
+ * prescaler as the system tick */
+#define PWM_OCR OCR2
+#define PWM_TCNT TCNT2
+#define PWM_vect TIMER2_COMP_vect
+#define PWM_TIMSK TIMSK
+#define PWM_OCIE _BV(OCIE2)
+#endif
+
+static void sw_init(void) {
+#if !defined(OCR0A)
+  TCCR2 = _BV(CS22);
+#endif
+  PWM_TIMSK |= PWM_OCIE;
+}
+
+#define PWM_SLOTS 7
+
+static uint8_t duties[NUM_RELAYS];
+/* Relays driven by the software engine */
+static volatile uint8_t sw_mask;
+/* Output state of the relays for each slot */
+static volatile uint8_t planes[PWM_SLOTS];
+
+ISR(PWM_vect, ISR_NOBLOCK) {
+  static uint8_t slot;
+
+  PWM_TIMSK &= ~PWM_OCIE;
+
+  do {
+    write_relays(sw_mask, planes[slot]);
+    /* Slot n lasts 2 << n timer counts, so a period is 254 counts */
+    PWM_OCR += 2 << slot;
+    slot = slot == PWM_SLOTS - 1 ? 0 : slot + 1;
+    /* If the interrupt was held off past the next compare value (e.g. by a USB
+     * transfer), move on to the next slot instead of waiting for the timer to
+     * wrap around */
+  } while ((uint8_t)(PWM_TCNT - PWM_OCR) < 0x80);
+
+  PWM_TIMSK |= PWM_OCIE;
+}
+
+static void update_planes(void) {
+  for (uint8_t slot = 0; slot < PWM_SLOTS; slot++) {
+    uint8_t plane = 0;
+
+    for (uint8_t i = 0; i < NUM_RELAYS; i++) {
+      if (duties[i] & (2 << slot)) {
+        plane |= 1 << i;
+      }
+    }
+    planes[slot] = plane;
+  }
+}
+
+uint8_t pwm_sw_active(void) { return sw_mask; }
+#endif /* PWM_SW_MASK */
+
+void pwm_init(void) {
+#if PWM_HW_CHANNELS
+  hw_init();
+#endif
+#if PWM_SW_MASK
+  sw_init();
+#endif
+}
+
+void pwm_set(uint8_t relay, uint8_t duty) {
+  switch (pgm_read_byte(&channels[relay])) {
+#if PWM_HW_CHANNELS & (1 << PWM_CHANNEL_OC1A)
+  case PWM_CHANNEL_OC1A:
+    SET_HW_CHANNEL(OCR1A, OC1A_CTRL, OC1A_COM);
+    return;
+#endif
+#if PWM_HW_CHANNELS & (1 << PWM_CHANNEL_OC1B)
+  case PWM_CHANNEL_OC1B:
+    SET_HW_CHANNEL(OCR1B, OC1B_CTRL, OC1B_COM);
+    return;
+#endif
+#if PWM_HW_CHANNELS & (1 << PWM_CHANNEL_OC1D)
+  case PWM_CHANNEL_OC1D:
+    SET_HW_CHANNEL(OCR1D, OC1D_CTRL, OC1D_COM);
+    return;
+#endif
+  }
+
+#if PWM_SW_MASK
+  {
+    uint8_t bit = 1 << relay;
+
+    if (duty == PWM_FULL) {
+      sw_mask &= ~bit;
+    }
+    duties[relay] = duty;
+    update_planes();
+    if (duty != PWM_FULL) {
+      sw_mask |= bit;
+    }
+  }
+#endif
+}
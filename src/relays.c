@@ -0,0 +1,250 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "relays.h"
+
+#include <avr/pgmspace.h>
+#if ENABLE_WATCHDOG
+#include <avr/wdt.h>
+#endif
+#include <util/delay.h>
+
+#include "feedback.h"
+#include "pwm.h"
+#include "reports.h"
+#include "timer.h"
+#include "wear.h"
+
+struct relay_stats relay_stats = {.report_id = REPORT_ID_RELAY_STATS};
+
+/* The state requested by the host */
+static uint8_t target;
+/* The state last written to the driver */
+static uint8_t applied;
+/* Ticks remaining before each relay may switch again */
+static uint16_t hold[NUM_RELAYS];
+
+static const uint16_t dwell_ticks[NUM_RELAYS] PROGMEM = {RELAY_DWELL_TICKS};
+
+#if RELAY_STAGGER_MS
+/* Ticks remaining before another relay may be energized */
+static uint16_t stagger_hold;
+#endif
+
+#if RELAY_ECONOMIZER_MS
+/* Ticks remaining before each energized relay drops to the hold duty cycle */
+static uint16_t pull_in[NUM_RELAYS];
+#endif
+
+#if RELAY_PWM_MODE_MASK
+/* Duty cycle of each relay in PWM mode while it is on */
+static uint8_t duties[NUM_RELAYS];
+#endif
+
+#if NUM_INTERLOCK_GROUPS
+static const uint8_t interlock_groups[NUM_INTERLOCK_GROUPS] PROGMEM = {
+    RELAY_INTERLOCK_GROUPS};
+/* Ticks remaining before a member of each group may be energized after
+ * another member was released */
+static uint16_t dead_time[NUM_INTERLOCK_GROUPS];
+
+/* Returns true if relay bit may be energized now. It must wait until every
+ * other member of its group has been released for the dead time */
+static bool interlock_clear(uint8_t bit) {
+  for (uint8_t g = 0; g < NUM_INTERLOCK_GROUPS; g++) {
+    uint8_t group = pgm_read_byte(&interlock_groups[g]);
+
+    if ((group & bit) && ((applied & group & ~bit) || dead_time[g])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void interlock_released(uint8_t bit) {
+  for (uint8_t g = 0; g < NUM_INTERLOCK_GROUPS; g++) {
+    if (pgm_read_byte(&interlock_groups[g]) & bit) {
+      dead_time[g] = TIMER_DELAY_TICKS(RELAY_INTERLOCK_DEAD_TIME_MS);
+    }
+  }
+}
+
+/* Turning on a member of a group turns off the other members. If a request
+ * turns on several members of one group, the lowest numbered one wins */
+static uint8_t interlock_target(uint8_t mask, uint8_t new_target) {
+  for (uint8_t g = 0; g < NUM_INTERLOCK_GROUPS; g++) {
+    uint8_t group = pgm_read_byte(&interlock_groups[g]);
+    uint8_t on = new_target & group & mask;
+
+    if (on) {
+      new_target &= ~group | (on & -on);
+    }
+  }
+  return new_target;
+}
+#endif
+
+static void apply(void) {
+  uint8_t pending = target ^ applied;
+
+  for (uint8_t i = 0; i < NUM_RELAYS; i++) {
+    uint8_t bit = 1 << i;
+
+    if (!(pending & bit) || hold[i]) {
+      continue;
+    }
+
+#if NUM_INTERLOCK_GROUPS
+    /* Break before make */
+    if ((target & bit) && !interlock_clear(bit)) {
+      continue;
+    }
+#endif
+
+#if RELAY_STAGGER_MS
+    /* Energize at most one coil per stagger step to limit the inrush current.
+     * Releasing relays is never delayed */
+    if (target & bit) {
+      if (stagger_hold) {
+        continue;
+      }
+      stagger_hold = TIMER_DELAY_TICKS(RELAY_STAGGER_MS);
+    }
+#endif
+
+#if USE_PWM
+    /* Every switch starts from full voltage so the relay can pull in */
+    pwm_set(i, PWM_FULL);
+#endif
+#if RELAY_ECONOMIZER_MS
+    pull_in[i] = (target & bit) && !(RELAY_PWM_MODE_MASK & bit)
+                     ? TIMER_DELAY_TICKS(RELAY_ECONOMIZER_MS)
+                     : 0;
+#endif
+
+    set_relay(i, target & bit);
+    applied ^= bit;
+
+#if NUM_INTERLOCK_GROUPS
+    if (!(target & bit)) {
+      interlock_released(bit);
+    }
+#endif
+
+#if RELAY_FEEDBACK_MASK
+    feedback_switched(i, target & bit);
+#endif
+#if RELAY_WEAR_COUNTERS
+    wear_switched(i, target & bit);
+#endif
+
+#if RELAY_PWM_MODE_MASK
+    if (RELAY_PWM_MODE_MASK & target & bit) {
+      pwm_set(i, duties[i]);
+    }
+#endif
+    hold[i] = pgm_read_word(&dwell_ticks[i]);
+  }
+}
+
+void relays_request(uint8_t mask, uint8_t state) {
+  for (uint8_t i = 0; i < NUM_RELAYS; i++) {
+    uint8_t bit = 1 << i;
+
+    if (!(mask & bit)) {
+      continue;
+    }
+
+    if ((target ^ applied) & bit) {
+      /* A change is already waiting on this relay; the new request either
+       * repeats or cancels it, but in both cases only the final state will be
+       * written */
+      relay_stats.coalesced++;
+    } else if (!((state ^ applied) & bit)) {
+      relay_stats.skipped++;
+    } else if (hold[i]) {
+      relay_stats.deferred++;
+    }
+  }
+
+#if RELAY_PWM_MODE_MASK
+  /* Plain on and off requests run PWM mode relays at full duty */
+  for (uint8_t i = 0; i < NUM_RELAYS; i++) {
+    if (RELAY_PWM_MODE_MASK & mask & (1 << i)) {
+      duties[i] = (state & (1 << i)) ? PWM_FULL : 0;
+    }
+  }
+#endif
+
+#if NUM_INTERLOCK_GROUPS
+  target = interlock_target(mask, (target & ~mask) | (state & mask));
+#else
+  target = (target & ~mask) | (state & mask);
+#endif
+  apply();
+}
+
+uint8_t relays_target(void) { return target; }
+
+#if RELAY_PWM_MODE_MASK
+void relays_set_duty(uint8_t relay, uint8_t duty) {
+  uint8_t bit = 1 << relay;
+
+  relays_request(bit, duty ? 0xFF : 0);
+  duties[relay] = duty;
+  /* A relay that is already on changes duty cycle right away, otherwise it
+   * starts with it when the scheduler switches it on. Software PWM may have
+   * left the latch off when it hands the output back at PWM_FULL */
+  if (duty && (applied & bit)) {
+    pwm_set(relay, duty);
+    set_relay(relay, true);
+  }
+}
+#endif
+
+void relays_poll(uint8_t elapsed) {
+  if (!elapsed) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < NUM_RELAYS; i++) {
+    hold[i] = hold[i] > elapsed ? hold[i] - elapsed : 0;
+
+#if RELAY_ECONOMIZER_MS
+    if (pull_in[i]) {
+      if (pull_in[i] > elapsed) {
+        pull_in[i] -= elapsed;
+      } else {
+        pull_in[i] = 0;
+        pwm_set(i, RELAY_ECONOMIZER_DUTY);
+      }
+    }
+#endif
+  }
+
+#if RELAY_STAGGER_MS
+  stagger_hold = stagger_hold > elapsed ? stagger_hold - elapsed : 0;
+#endif
+
+#if NUM_INTERLOCK_GROUPS
+  for (uint8_t g = 0; g < NUM_INTERLOCK_GROUPS; g++) {
+    dead_time[g] = dead_time[g] > elapsed ? dead_time[g] - elapsed : 0;
+  }
+#endif
+
+  apply();
+}
+
+void relays_settle(void) {
+  /* The system tick is not running yet, so wait out the stagger and interlock
+   * dead times here, one tick at a time */
+  while (target != applied) {
+#if ENABLE_WATCHDOG
+    wdt_reset();
+#endif
+    _delay_ms(TIMER_TICK_CYCLES * 1000.0 / F_CPU);
+    relays_poll(1);
+  }
+}
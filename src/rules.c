@@ -0,0 +1,127 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * The rules act on the debounced input state, and go through the same
+ * relays_request() as the host commands, so the scheduler policies apply to
+ * them too. A host command that conflicts with an active level rule is undone
+ * on the next pass of the main loop.
+ */
+#include "rules.h"
+
+#include <avr/eeprom.h>
+
+#include "inputs.h"
+#include "relays.h"
+#include "reports.h"
+#include "timer.h"
+
+static struct rule EEMEM saved_rules[NUM_RULES];
+
+struct rules_report rules_report = {.report_id = REPORT_ID_RULES};
+
+static uint16_t delay_ticks[NUM_RULES];
+static uint16_t countdown[NUM_RULES];
+/* Rules whose countdown is running, or that are forcing the relays */
+static uint8_t running;
+static uint8_t last_inputs;
+
+static void load_rule(uint8_t index) {
+  uint16_t delay_ms = rules_report.rules[index].delay_ms;
+
+  if (delay_ms > RULE_MAX_DELAY_MS) {
+    delay_ms = RULE_MAX_DELAY_MS;
+  }
+  delay_ticks[index] = TIMER_DELAY_TICKS((uint32_t)delay_ms);
+  running &= ~(1 << index);
+}
+
+void init_rules(void) {
+  eeprom_read_block(rules_report.rules, saved_rules, sizeof(saved_rules));
+  for (uint8_t i = 0; i < NUM_RULES; i++) {
+    load_rule(i);
+  }
+  last_inputs = get_input_state();
+}
+
+void rules_set(uint8_t index, struct rule const *rule) {
+  rules_report.rules[index] = *rule;
+  load_rule(index);
+  eeprom_update_block(rule, &saved_rules[index], sizeof(*rule));
+}
+
+void rules_poll(uint8_t elapsed) {
+  uint16_t start = timer_stamp();
+  uint8_t inputs = get_input_state();
+  uint8_t rising = inputs & ~last_inputs;
+  uint8_t falling = ~inputs & last_inputs;
+  uint8_t mask = 0;
+  uint8_t state = 0;
+
+  last_inputs = inputs;
+
+  for (uint8_t i = 0; i < NUM_RULES; i++) {
+    struct rule const *r = &rules_report.rules[i];
+    uint8_t input = 1 << RULE_INPUT(r->trigger);
+    uint8_t bit = 1 << i;
+
+    if (RULE_INPUT(r->trigger) >= NUM_INPUTS) {
+      continue;
+    }
+
+    switch (RULE_TYPE(r->trigger)) {
+    case RULE_RISING:
+    case RULE_FALLING:
+      if ((RULE_TYPE(r->trigger) == RULE_RISING ? rising : falling) & input) {
+        countdown[i] = delay_ticks[i];
+        running |= bit;
+      }
+      break;
+
+    case RULE_HIGH:
+    case RULE_LOW:
+      if (!(inputs & input) == (RULE_TYPE(r->trigger) == RULE_HIGH)) {
+        running &= ~bit;
+      } else if (!(running & bit)) {
+        countdown[i] = delay_ticks[i];
+        running |= bit;
+      }
+      break;
+
+    default:
+      continue;
+    }
+
+    if (!(running & bit)) {
+      continue;
+    }
+
+    if (countdown[i] > elapsed) {
+      countdown[i] -= elapsed;
+      continue;
+    }
+    countdown[i] = 0;
+
+    /* Later rules take precedence over earlier ones */
+    mask |= r->mask;
+    state = (state & ~r->mask) | (r->state & r->mask);
+
+    if (RULE_TYPE(r->trigger) == RULE_RISING ||
+        RULE_TYPE(r->trigger) == RULE_FALLING) {
+      running &= ~bit;
+    }
+  }
+
+  /* Compared with the requested state, so that a change the scheduler is
+   * still holding back is not requested again on every pass */
+  mask &= RELAY_ALL_MASK;
+  if ((relays_target() ^ state) & mask) {
+    relays_request(mask, state);
+  }
+
+  rules_report.cost = timer_stamp() - start;
+  if (rules_report.cost > rules_report.max_cost) {
+    rules_report.max_cost = rules_report.cost;
+  }
+}
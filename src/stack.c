@@ -0,0 +1,44 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "stack.h"
+
+#include "reports.h"
+
+#define STACK_CANARY 0xC5
+
+/* Defined by the avr-libc linker scripts */
+extern uint8_t __data_start;
+extern uint8_t _end;
+extern uint8_t __stack;
+
+static struct stack_report report = {.report_id = REPORT_ID_STACK};
+
+/*
+ * Runs from .init3, after the stack pointer has been set up in .init2 and
+ * before .data and .bss are initialized in .init4. Nothing is on the stack yet
+ * (the init sections fall through into each other without calls), so all of
+ * the RAM above the static variables can be painted
+ */
+void stack_paint(void) __attribute__((naked, used, section(".init3")));
+void stack_paint(void) {
+  uint8_t *p = &_end;
+
+  while (p <= &__stack) {
+    *p++ = STACK_CANARY;
+  }
+}
+
+struct stack_report *stack_snapshot(void) {
+  uint8_t const *p = &_end;
+
+  while (p <= &__stack && *p == STACK_CANARY) {
+    p++;
+  }
+
+  report.static_ram = &_end - &__data_start;
+  report.unused = p - &_end;
+  return &report;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ */
+#include "timer.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#if defined(TIFR0)
+#define TIMER_TIFR TIFR0
+#else
+#define TIMER_TIFR TIFR
+#endif
+
+volatile uint8_t timer_ticks;
+
+ISR(TIMER0_OVF_vect, ISR_NOBLOCK) { timer_ticks++; }
+
+void timer_init(void) {
+#if defined(TCCR0B)
+  TCCR0B = _BV(CS01) | _BV(CS00);
+#else
+  TCCR0 = _BV(CS01) | _BV(CS00);
+#endif
+
+#if defined(TIMSK0)
+  TIMSK0 |= _BV(TOIE0);
+#else
+  TIMSK |= _BV(TOIE0);
+#endif
+}
+
+uint8_t timer_elapsed(void) {
+  static uint8_t last;
+  uint8_t now = timer_ticks;
+  uint8_t elapsed = now - last;
+
+  last = now;
+  return elapsed;
+}
+
+uint16_t timer_stamp(void) {
+  uint8_t hi;
+  uint8_t lo;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    hi = timer_ticks;
+    lo = TCNT0;
+    /* Account for an overflow that has not been serviced yet */
+    if ((TIMER_TIFR & _BV(TOV0)) && lo < 0x80) {
+      hi++;
+    }
+  }
+
+  return (hi << 8) | lo;
+}
@@ -0,0 +1,31 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Events are only added from the main loop (including the callbacks made by
+ * usbPoll()), so the buffer needs no locking.
+ */
+#include "trace.h"
+
+#include "reports.h"
+
+struct trace_report trace_report = {.report_id = REPORT_ID_TRACE};
+
+void trace_add(uint8_t event, uint8_t data0, uint8_t data1) {
+  struct trace_entry *e = &trace_report.entries[trace_report.head];
+
+  e->time = trace_report.now;
+  e->event = event;
+  e->data[0] = data0;
+  e->data[1] = data1;
+
+  if (++trace_report.head == TRACE_ENTRIES) {
+    trace_report.head = 0;
+  }
+  if (trace_report.count < TRACE_ENTRIES) {
+    trace_report.count++;
+  }
+}
+
+void trace_poll(uint8_t elapsed) { trace_report.now += elapsed; }
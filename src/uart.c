@@ -0,0 +1,324 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * The receive interrupt can't re-enable interrupts before UDR is read, since
+ * the RXC flag would call it again straight away, and it can't read UDR
+ * quickly enough to stay within the V-USB interrupt latency. So received
+ * bytes are read by the main loop instead, which runs far more often than
+ * bytes arrive; the USART holds up to three bytes until it does. Answers are
+ * sent from the transmit complete interrupt, whose flag is cleared when it is
+ * called, so it re-enables interrupts first like the others.
+ *
+ * A board that controls a chain (see include/chain.h) sends the requests
+ * instead, and passes the answers to the chain.
+ */
+#include "uart.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <string.h>
+#include <util/crc16.h>
+
+#if NUM_ADC_CHANNELS
+#include "adc.h"
+#endif
+#if CHAIN_BOARDS
+#include "chain.h"
+#endif
+#include "command.h"
+#if NUM_COUNTERS
+#include "counters.h"
+#endif
+#include "feedback.h"
+#include "main.h"
+#if NUM_MACROS
+#include "macros.h"
+#endif
+#include "relays.h"
+#if NUM_RULES
+#include "rules.h"
+#endif
+#if STACK_MONITOR
+#include "stack.h"
+#endif
+#include "timer.h"
+#if TRACE_ENTRIES
+#include "trace.h"
+#endif
+#include "wear.h"
+
+#define BAUD UART_BAUD
+#include <util/setbaud.h>
+
+#define _concat(a, b) a##b
+#define concat(a, b) _concat(a, b)
+
+#ifdef UART_DE_IOPORT_NAME
+#define DE_PORT concat(PORT, UART_DE_IOPORT_NAME)
+#define DE_DDR concat(DDR, UART_DE_IOPORT_NAME)
+#define DE_MASK _BV(UART_DE_BIT)
+
+#define de_on() (DE_PORT |= DE_MASK)
+#define de_off() (DE_PORT &= ~DE_MASK)
+#else
+#define de_on()
+#define de_off()
+#endif
+
+#define GAP_TICKS TIMER_DELAY_TICKS(UART_GAP_MS)
+
+enum rx_state {
+  RX_SYNC,
+  RX_ADDRESS,
+  RX_LENGTH,
+  RX_DATA,
+  RX_CRC_LO,
+  RX_CRC_HI,
+};
+
+static enum rx_state rx_state;
+static uint8_t rx_address;
+static uint8_t rx_length;
+static uint8_t rx_count;
+/* The type, followed by the data */
+static uint8_t rx_buf[1 + UART_MAX_DATA];
+static uint16_t rx_crc;
+static uint8_t rx_gap;
+
+/* The data of the largest frame that is sent */
+#if CHAIN_BOARDS
+union tx_data {
+  uint8_t command[CHAIN_MAX_COMMAND];
+};
+#else
+union tx_data {
+  uint8_t status;
+  uint8_t relays[RELAYS_REPORT_LEN];
+#if NUM_RELAYS > 8
+  uint8_t banks[2 + RELAY_BANKS];
+#endif
+#if RELAY_SCHEDULER
+  struct relay_stats relay_stats;
+#endif
+#if RELAY_FEEDBACK_MASK
+  struct feedback_stats feedback_stats;
+#endif
+#if NUM_COUNTERS
+  struct counters_report counters;
+#endif
+#if NUM_ADC_CHANNELS
+  struct adc_report adc;
+#endif
+#if NUM_RULES
+  struct rules_report rules;
+#endif
+#if NUM_MACROS
+  struct macros_report macros;
+#endif
+#if RELAY_WEAR_COUNTERS
+  struct wear_report wear;
+#endif
+#if TRACE_ENTRIES
+  struct trace_report trace;
+#endif
+#if STACK_MONITOR
+  struct stack_report stack;
+#endif
+};
+#endif
+
+/* The whole frame being sent. The data is copied in, since reports can change
+ * while they are being sent, and the CRC must match what was sent */
+static uint8_t tx_buf[4 + sizeof(union tx_data) + 2];
+_Static_assert(sizeof(tx_buf) <= 255, "A report is too long for a frame");
+static uint8_t tx_pos;
+static uint8_t tx_end;
+static volatile bool tx_busy;
+
+ISR(USART_TXC_vect, ISR_NOBLOCK) {
+  if (tx_pos < tx_end) {
+    UDR = tx_buf[tx_pos++];
+    return;
+  }
+
+  /* The last byte has left the shift register, so the bus can be released */
+  UCSRB &= ~_BV(TXCIE);
+  de_off();
+  tx_busy = false;
+}
+
+void uart_send(uint8_t address, uint8_t type, uint8_t const *data,
+               uint8_t len) {
+  uint16_t crc = 0xFFFF;
+
+  if (len > sizeof(union tx_data)) {
+    len = 0;
+  }
+
+  tx_buf[0] = UART_SYNC;
+  tx_buf[1] = address;
+  tx_buf[2] = len + 1;
+  tx_buf[3] = type;
+  memcpy(&tx_buf[4], data, len);
+  tx_end = 4 + len;
+
+  for (uint8_t i = 1; i < tx_end; i++) {
+    crc = _crc16_update(crc, tx_buf[i]);
+  }
+  tx_buf[tx_end++] = crc & 0xFF;
+  tx_buf[tx_end++] = crc >> 8;
+
+  tx_pos = 1;
+  tx_busy = true;
+
+  de_on();
+  UDR = tx_buf[0];
+  UCSRB |= _BV(TXCIE);
+}
+
+#if CHAIN_BOARDS
+/* The boards of the chain only send answers */
+static void handle_frame(void) {
+  if (rx_buf[0] & UART_REPLY) {
+    chain_answer(rx_address, rx_buf[0] & ~UART_REPLY, &rx_buf[1],
+                 rx_length - 1);
+  }
+}
+#else
+static void handle_frame(void) {
+  static uint8_t status;
+  uint8_t const *report;
+  uint8_t len;
+
+  /* Answers from other boards, or our own echo on a bus that has the
+   * receiver enabled while sending */
+  if (rx_buf[0] & UART_REPLY) {
+    return;
+  }
+  if (rx_address != UART_ADDRESS && rx_address != UART_BROADCAST) {
+    return;
+  }
+
+  switch (rx_buf[0]) {
+  case UART_TYPE_COMMAND:
+    status = command_handle(&rx_buf[1], rx_length - 1);
+    report = &status;
+    len = 1;
+    break;
+
+  case UART_TYPE_GET_REPORT:
+    if (rx_length < 2) {
+      return;
+    }
+    len = command_report(rx_buf[1], &report);
+    break;
+
+  default:
+    return;
+  }
+
+  if (rx_address != UART_BROADCAST) {
+    uart_send(UART_ADDRESS, rx_buf[0] | UART_REPLY, report, len);
+  }
+}
+#endif
+
+static void receive(uint8_t c) {
+  if (rx_state == RX_SYNC) {
+    if (c == UART_SYNC) {
+      rx_crc = 0xFFFF;
+      rx_state = RX_ADDRESS;
+    }
+    return;
+  }
+
+  /* The CRC of a frame, including its own CRC, is 0 */
+  rx_crc = _crc16_update(rx_crc, c);
+
+  switch (rx_state) {
+  case RX_ADDRESS:
+    rx_address = c;
+    rx_state = RX_LENGTH;
+    break;
+
+  case RX_LENGTH:
+    rx_length = c;
+    rx_count = 0;
+    rx_state = c ? RX_DATA : RX_SYNC;
+    break;
+
+  case RX_DATA:
+    /* Longer frames are answers from other boards, and are only followed to
+     * stay in step with the bus */
+    if (rx_count < sizeof(rx_buf)) {
+      rx_buf[rx_count] = c;
+    }
+    if (++rx_count == rx_length) {
+      rx_state = RX_CRC_LO;
+    }
+    break;
+
+  case RX_CRC_LO:
+    rx_state = RX_CRC_HI;
+    break;
+
+  case RX_CRC_HI:
+    rx_state = RX_SYNC;
+    if (rx_crc == 0 && rx_length <= sizeof(rx_buf) && !tx_busy) {
+      handle_frame();
+    }
+    break;
+
+  case RX_SYNC:
+    break;
+  }
+}
+
+void init_uart(void) {
+  UBRRH = UBRRH_VALUE;
+  UBRRL = UBRRL_VALUE;
+#if USE_2X
+  UCSRA |= _BV(U2X);
+#else
+  UCSRA &= ~_BV(U2X);
+#endif
+  /* UCSRC resets to 8 data bits, no parity and 1 stop bit */
+  UCSRB = _BV(RXEN) | _BV(TXEN);
+
+#ifdef UART_DE_IOPORT_NAME
+  DE_DDR |= DE_MASK;
+  de_off();
+#endif
+}
+
+void uart_poll(uint8_t elapsed) {
+  /* Bytes that are waiting were not late, even if the main loop was */
+  if (!(UCSRA & _BV(RXC))) {
+    if (rx_state != RX_SYNC) {
+      if (elapsed >= rx_gap) {
+        rx_state = RX_SYNC;
+      } else {
+        rx_gap -= elapsed;
+      }
+    }
+    return;
+  }
+
+  while (UCSRA & _BV(RXC)) {
+    /* The error flags belong to the byte in UDR, so they are read first */
+    uint8_t errors = UCSRA & (_BV(FE) | _BV(DOR));
+    uint8_t c = UDR;
+
+    if (errors) {
+      rx_state = RX_SYNC;
+      continue;
+    }
+
+    rx_gap = GAP_TICKS;
+    receive(c);
+  }
+}
+
+bool uart_busy(void) { return tx_busy; }
@@ -101,7 +101,7 @@ section at the end of this file).
  * it is required by the standard. We have made it a config option because it
  * bloats the code considerably.
  */
-#define USB_CFG_SUPPRESS_INTR_CODE      1
+#define USB_CFG_SUPPRESS_INTR_CODE      (!USB_INTR_REPORTS)
 /* Define this to 1 if you want to declare interrupt-in endpoints, but don't
  * want to send any data over them. If this macro is defined to 1, functions
  * usbSetInterrupt() and usbSetInterrupt3() are omitted. This is useful if
@@ -204,15 +204,29 @@ section at the end of this file).
  * for each control- and out-endpoint to check for duplicate packets.
  */
 
-#if CALIBRATE_OSCILLATOR
+#if CALIBRATE_OSCILLATOR || TRACE_ENTRIES || USB_ERROR_COUNTERS
 #ifndef __ASSEMBLER__
 void usbEventResetReady(void);
 #endif
 #define USB_RESET_HOOK(isReset)             if(!isReset){usbEventResetReady();}
+#endif
+
+#if CALIBRATE_OSCILLATOR
 #define USB_CFG_HAVE_MEASURE_FRAME_LENGTH   1
 #else
 #define USB_CFG_HAVE_MEASURE_FRAME_LENGTH   0
 #endif
+
+#if TRACE_ENTRIES || USB_ERROR_COUNTERS
+#ifndef __ASSEMBLER__
+void usbEventCrcError(unsigned char len);
+void usbEventBadSetup(unsigned char len);
+#endif
+/* Called by usbProcessRx() when CHECK_CRC drops a packet */
+#define USB_RX_CRC_ERROR_HOOK(data, len)    usbEventCrcError(len);
+/* Called by usbProcessRx() when it drops a SETUP packet that is not 8 bytes */
+#define USB_RX_BAD_SETUP_HOOK(data, len)    usbEventBadSetup(len);
+#endif
 /* define this macro to 1 if you want the function usbMeasureFrameLength()
  * compiled in. This function can be used to calibrate the AVR's RC oscillator.
  */
@@ -263,7 +277,9 @@ void usbEventResetReady(void);
  * obdev's free shared VID/PID pair. See the file USB-IDs-for-free.txt for
  * details.
  */
-#define USB_CFG_DEVICE_NAME     'U', 'S', 'B', 'R', 'e', 'l', 'a', 'y', '0' + NUM_RELAYS
+/* Hosts take the number of relays from the last character of the name, so a
+ * board with more than 8 relays is shown as one with the first 8 */
+#define USB_CFG_DEVICE_NAME     'U', 'S', 'B', 'R', 'e', 'l', 'a', 'y', '0' + (NUM_RELAYS > 8 ? 8 : NUM_RELAYS)
 #define USB_CFG_DEVICE_NAME_LEN 9
 /* Same as above for the device name. If you don't want a device name, undefine
  * the macros. See the file USB-IDs-for-free.txt before you assign a name if
@@ -291,7 +307,7 @@ void usbEventResetReady(void);
  * HID class is 3, no subclass and protocol required (but may be useful!)
  * CDC class is 2, use subclass 2 and protocol 1 for ACM
  */
-#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    22
+#define USB_CFG_HID_REPORT_DESCRIPTOR_LENGTH    (22 + (USB_INTR_REPORTS ? 4 : 0))
 /* Define this to the length of the HID report descriptor, if you implement
  * an HID device. Otherwise don't define it or define it to 0.
  * If you use this define, you must add a PROGMEM character array named
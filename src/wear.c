@@ -0,0 +1,138 @@
+/*
+ * Copyright 2023 Joshua Watt <JPEWhacker@gmail.com>
+ *
+ * SPDX-License-Identifier: GPL-2.0
+ *
+ * Each save writes a snapshot of the counters to the oldest slot of the ring,
+ * tagged with a sequence number, and the newest slot is loaded at boot. The
+ * snapshot is written one byte per pass of the main loop, and only once the
+ * EEPROM has finished the previous byte, so a save never stalls usbPoll().
+ * The sequence number of the slot is invalidated first and written last, so a
+ * save interrupted by a power loss leaves the previous slot as the newest.
+ */
+#include "wear.h"
+
+#include <avr/eeprom.h>
+
+#include "reports.h"
+#include "timer.h"
+
+#define SEQ_INVALID 0xFFFF
+
+struct wear_record {
+  uint16_t seq;
+  struct wear_counters counters;
+};
+
+static struct wear_record EEMEM saved[RELAY_WEAR_SLOTS];
+
+struct wear_report wear_report = {.report_id = REPORT_ID_WEAR};
+
+/* The relays that are on */
+static uint8_t energized;
+/* CPU cycles towards the next second */
+static uint32_t sub_second;
+static uint16_t seconds_to_save = RELAY_WEAR_SAVE_S;
+static bool dirty;
+
+/* The snapshot being saved, and the slot it goes to */
+static struct wear_record record;
+static uint8_t slot;
+/* Byte of the save that is written next, or 0 when idle */
+static uint8_t write_pos;
+
+#define WRITE_STEPS (sizeof(struct wear_record) + sizeof(uint16_t))
+
+void init_wear(void) {
+  uint16_t newest = SEQ_INVALID;
+
+  for (uint8_t i = 0; i < RELAY_WEAR_SLOTS; i++) {
+    uint16_t seq = eeprom_read_word(&saved[i].seq);
+
+    if (seq == SEQ_INVALID) {
+      continue;
+    }
+
+    if (newest == SEQ_INVALID || (int16_t)(seq - newest) > 0) {
+      newest = seq;
+      slot = i;
+    }
+  }
+
+  if (newest != SEQ_INVALID) {
+    eeprom_read_block(&wear_report.counters, &saved[slot].counters,
+                      sizeof(wear_report.counters));
+    record.seq = newest;
+  }
+}
+
+void wear_switched(uint8_t relay, bool on) {
+  uint8_t bit = 1 << relay;
+
+  if (on) {
+    energized |= bit;
+    wear_report.counters.cycles[relay]++;
+    dirty = true;
+  } else {
+    energized &= ~bit;
+  }
+}
+
+static void start_save(void) {
+  record.counters = wear_report.counters;
+  if (++record.seq == SEQ_INVALID) {
+    record.seq = 0;
+  }
+  if (++slot >= RELAY_WEAR_SLOTS) {
+    slot = 0;
+  }
+  write_pos = 1;
+  dirty = false;
+}
+
+static void write_step(void) {
+  uint8_t *dst = (uint8_t *)&saved[slot];
+  uint8_t const *src = (uint8_t const *)&record;
+  uint8_t pos = write_pos - 1;
+
+  if (pos < sizeof(uint16_t)) {
+    eeprom_update_byte(&dst[pos], 0xFF);
+  } else if (pos < sizeof(record)) {
+    eeprom_update_byte(&dst[pos], src[pos]);
+  } else {
+    pos -= sizeof(record);
+    eeprom_update_byte(&dst[pos], src[pos]);
+  }
+
+  write_pos = write_pos < WRITE_STEPS ? write_pos + 1 : 0;
+}
+
+void wear_poll(uint8_t elapsed) {
+  if (write_pos && eeprom_is_ready()) {
+    write_step();
+  }
+
+  if (!elapsed) {
+    return;
+  }
+
+  sub_second += (uint16_t)elapsed * TIMER_TICK_CYCLES;
+  if (sub_second < F_CPU) {
+    return;
+  }
+  sub_second -= F_CPU;
+
+  for (uint8_t i = 0; i < NUM_RELAYS; i++) {
+    if (energized & (1 << i)) {
+      wear_report.counters.on_time[i]++;
+      dirty = true;
+    }
+  }
+
+  if (--seconds_to_save == 0) {
+    seconds_to_save = RELAY_WEAR_SAVE_S;
+    if (dirty && !write_pos) {
+      start_save();
+    }
+  }
+}
@@ -13,10 +13,55 @@
 
 #warning "Never compile production devices with debugging enabled"
 
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/* The output is queued in a ring buffer and sent from the transmit complete
+ * interrupt, so that debug logs don't stall the main loop (and with it USB)
+ * for the time it takes to send them. The transmit complete flag is cleared
+ * when its interrupt runs, so unlike the data register empty interrupt it can
+ * re-enable interrupts right away and never delays the USB interrupt.
+ */
+#ifndef ODDBG_BUFFER_SIZE
+#   define ODDBG_BUFFER_SIZE    64
+#endif
+#define ODDBG_BUFFER_MASK   (ODDBG_BUFFER_SIZE - 1)
+
+#if (ODDBG_BUFFER_SIZE & ODDBG_BUFFER_MASK) || ODDBG_BUFFER_SIZE > 256
+#   error "ODDBG_BUFFER_SIZE must be a power of 2 of at most 256"
+#endif
+
+#if defined USART_TXC_vect
+#   define ODDBG_TXC_vect   USART_TXC_vect
+#elif defined USART0_TX_vect
+#   define ODDBG_TXC_vect   USART0_TX_vect
+#else
+#   define ODDBG_TXC_vect   USART_TX_vect
+#endif
+
+static uchar            buffer[ODDBG_BUFFER_SIZE];
+static volatile uchar   head;   /* written by odDebug() */
+static volatile uchar   tail;   /* written by the interrupt */
+static volatile uchar   busy;
+/* Logs dropped since the last one that fit */
+static uchar            dropped;
+
+ISR(ODDBG_TXC_vect, ISR_NOBLOCK)
+{
+uchar   t = tail;
+
+    if(t == head){
+        busy = 0;
+        return;
+    }
+    ODDBG_UDR = buffer[t];
+    tail = (t + 1) & ODDBG_BUFFER_MASK;
+}
+
 static void uartPutc(char c)
 {
-    while(!(ODDBG_USR & (1 << ODDBG_UDRE)));    /* wait for data register empty */
-    ODDBG_UDR = c;
+    buffer[head] = c;
+    head = (head + 1) & ODDBG_BUFFER_MASK;
 }
 
 static uchar    hexAscii(uchar h)
@@ -36,6 +81,23 @@ static void printHex(uchar c)
 
 void    odDebug(uchar prefix, uchar *data, uchar len)
 {
+uchar   space = (tail - head - 1) & ODDBG_BUFFER_MASK;
+uchar   needed = 5 + 3 * len + (dropped ? 5 : 0);
+
+    /* Whole logs are dropped so that the output stays readable. The next log
+     * that fits is preceded by a line with the number of dropped logs */
+    if(len > (ODDBG_BUFFER_SIZE - 10) / 3 || needed > space){
+        if(dropped < 0xff)
+            dropped++;
+        return;
+    }
+    if(dropped){
+        uartPutc('!');
+        printHex(dropped);
+        uartPutc('\r');
+        uartPutc('\n');
+        dropped = 0;
+    }
     printHex(prefix);
     uartPutc(':');
     while(len--){
@@ -44,6 +106,15 @@ void    odDebug(uchar prefix, uchar *data, uchar len)
     }
     uartPutc('\r');
     uartPutc('\n');
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        if(!busy){
+            uchar   t = tail;
+            busy = 1;
+            ODDBG_UDR = buffer[t];
+            tail = (t + 1) & ODDBG_BUFFER_MASK;
+        }
+    }
 }
 
 #endif
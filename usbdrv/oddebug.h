@@ -88,6 +88,12 @@ extern void odDebug(uchar prefix, uchar *data, uchar len);
 #   define  ODDBG_TXEN  TXEN0
 #endif
 
+#if defined TXCIE
+#   define  ODDBG_TXCIE TXCIE
+#else
+#   define  ODDBG_TXCIE TXCIE0
+#endif
+
 #if defined USR
 #   define  ODDBG_USR   USR
 #elif defined UCSRA
@@ -110,7 +116,7 @@ extern void odDebug(uchar prefix, uchar *data, uchar len);
 
 static inline void  odDebugInit(void)
 {
-    ODDBG_UCR |= (1<<ODDBG_TXEN);
+    ODDBG_UCR |= (1<<ODDBG_TXEN) | (1<<ODDBG_TXCIE);
     ODDBG_UBRR = F_CPU / (19200 * 16L) - 1;
 }
 #else
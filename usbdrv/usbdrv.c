@@ -280,6 +280,12 @@ USB_PUBLIC void usbSetInterrupt3(uchar *data, uchar len)
 #ifndef USB_RX_USER_HOOK
 #define USB_RX_USER_HOOK(data, len)
 #endif
+#ifndef USB_RX_CRC_ERROR_HOOK
+#define USB_RX_CRC_ERROR_HOOK(data, len)
+#endif
+#ifndef USB_RX_BAD_SETUP_HOOK
+#define USB_RX_BAD_SETUP_HOOK(data, len)
+#endif
 #ifndef USB_SET_ADDRESS_HOOK
 #define USB_SET_ADDRESS_HOOK()
 #endif
@@ -429,8 +435,10 @@ usbRequest_t    *rq = (void *)data;
  */
     DBG2(0x10 + (usbRxToken & 0xf), data, len + 2); /* SETUP=1d, SETUP-DATA=11, OUTx=1x */
 #if CHECK_CRC
-    if (usbCrc16(data, len + 2) != 0x4FFE)
+    if (usbCrc16(data, len + 2) != 0x4FFE) {
+        USB_RX_CRC_ERROR_HOOK(data, len)
         return;
+    }
 #endif
     USB_RX_USER_HOOK(data, len)
 #if USB_CFG_IMPLEMENT_FN_WRITEOUT
@@ -440,8 +448,10 @@ usbRequest_t    *rq = (void *)data;
     }
 #endif
     if(usbRxToken == (uchar)USBPID_SETUP){
-        if(len != 8)    /* Setup size must be always 8 bytes. Ignore otherwise. */
+        if(len != 8){   /* Setup size must be always 8 bytes. Ignore otherwise. */
+            USB_RX_BAD_SETUP_HOOK(data, len)
             return;
+        }
         usbMsgLen_t replyLen;
         usbTxBuf[0] = USBPID_DATA0;         /* initialize data toggling */
         usbTxLen = USBPID_NAK;              /* abort pending transmit */